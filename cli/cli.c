@@ -54,7 +54,12 @@ const cmd_entry_t builtin_cmd_table[] = {
     /* -- cli_info.c ------------------- */
     /* name         min     max function */
     {"meminfo",    0,      0,   &do_meminfo,  "info on memory state" },
-    {"netinfo",     0,      0,  &do_netinfo,  "network statistics" },
+    {"netinfo",     0,      1,  &do_netinfo,  "network statistics (netinfo reset: zero the counters)" },
+    {"netcap",      0,      3,  &do_netcap,   "capture packets [start [kbytes [snaplen]] | stop | save filename]" },
+    {"diskcache",   0,      1,  &do_diskcache,"disk cache statistics [reset | drop]" },
+    {"cksumbench",  0,      1,  &do_cksumbench,"benchmark IP checksum routines [length]" },
+    {"rxbench",     0,      0,  &do_rxbench,  "benchmark network receive path" },
+    {"diskbench",   0,      2,  &do_diskbench,"benchmark disk and filesystem throughput [drive [kbytes]]" },
     {"help",        0,      0,  &help,        "list this help info"   },
     {"date",        0,      0,  &do_date,     "display date from RTC"   },
 
@@ -63,6 +68,14 @@ const cmd_entry_t builtin_cmd_table[] = {
     {"tftp",        1,      3,  &do_tftp_get, "retrieve file with TFTP" },
     {"tftpget",     1,      3,  &do_tftp_get, "retrieve file with TFTP" },
     {"tftpput",     1,      3,  &do_tftp_put, "send file with TFTP" },
+    {"tftpload",    2,      3,  &do_tftp_load,"retrieve file with TFTP direct to memory" },
+    {"tftpboot",    1,      0,  &do_tftp_boot,"retrieve ELF executable with TFTP and run it" },
+    {"netboot",     0,      0,  &do_netboot,  "retrieve the DHCP boot file (ELF or script) with TFTP and run it" },
+
+    /* -- cli_http.c ------------------- */
+    /* name         min     max function */
+    {"httpget",     1,      3,  &do_http_get, "httpget [-c] url [file]: retrieve file with HTTP" },
+    {"httpload",    2,      2,  &do_http_load,"httpload url address: retrieve file with HTTP direct to memory" },
 
     /* -- cli_load.c ------------------- */
     /* name         min     max function */
@@ -175,11 +188,13 @@ static bool handle_cmd_table(char *arg[], int numarg, const cmd_entry_t *cmd)
     return false;
 }
 
-static void execute_script(char *_name, FIL *fd) /* the buffer name lives in will be re-used shortly */
+/* scripts are read one character at a time; the reader returns -1 at the end */
+typedef int (*script_getc_t)(void *source);
+
+static void run_script(const char *_name, script_getc_t script_getc, void *source) /* the buffer name lives in will be re-used shortly */
 {
-    int i;
+    int i, c;
     bool eof;
-    unsigned int bytes_read;
     char name[40];
 
     strncpy(name, _name, sizeof(name));
@@ -188,10 +203,12 @@ static void execute_script(char *_name, FIL *fd) /* the buffer name lives in wil
     eof = false;
     i = 0;
     do{
-        if(f_read(fd, &cmd_buffer[i], 1, &bytes_read) != FR_OK || bytes_read != 1){
-            cmd_buffer[i] = '\n';
+        c = script_getc(source);
+        if(c < 0){
+            c = '\n';
             eof = true;
         }
+        cmd_buffer[i] = c;
         if(cmd_buffer[i] == '\n' || cmd_buffer[i] == '\r'){
             cmd_buffer[i] = 0;
             net_pump(); /* yes, once per line inside scripts! */
@@ -211,6 +228,44 @@ static void execute_script(char *_name, FIL *fd) /* the buffer name lives in wil
     }while(!eof);
 }
 
+static int script_file_getc(void *source)
+{
+    char c;
+    unsigned int bytes_read;
+
+    if(f_read((FIL*)source, &c, 1, &bytes_read) != FR_OK || bytes_read != 1)
+        return -1;
+    return (unsigned char)c;
+}
+
+static void execute_script(char *name, FIL *fd)
+{
+    run_script(name, script_file_getc, fd);
+}
+
+typedef struct {
+    const char *script;
+    int length;
+    int pos;
+} script_buffer_t;
+
+static int script_buffer_getc(void *source)
+{
+    script_buffer_t *buffer = source;
+
+    if(buffer->pos >= buffer->length)
+        return -1;
+    return (unsigned char)buffer->script[buffer->pos++];
+}
+
+/* as execute_script, for a script held in memory (eg fetched over the network) */
+void execute_script_buffer(const char *name, const char *script, int length)
+{
+    script_buffer_t buffer = { script, length, 0 };
+
+    run_script(name, script_buffer_getc, &buffer);
+}
+
 #define HEADER_EXAMINE_SIZE 16 /* number of bytes we examine to determine the file type */
 const char coff_header_bytes[2] = { 0x01, 0x50 };
 const char elf_header_bytes[4]  = { 0x7F, 0x45, 0x4c, 0x46 };
@@ -371,7 +426,8 @@ static int getline(char *line, int linesize)
     return k;
 }
 
-static void run_autoexec(const char *filename)
+// returns false if there is no script to run
+static bool run_autoexec(const char *filename)
 {
     FRESULT fr;
     FIL fd;
@@ -382,7 +438,7 @@ static void run_autoexec(const char *filename)
         f_close(&fd);
     }else{
         printf("No \"%s\" script: %s\n", filename, f_errmsg(fr));
-        return; // nothing found
+        return false; // nothing found
     }
 
     timer = set_timer_ms(AUTOBOOT_TIMEOUT_MS);
@@ -391,12 +447,13 @@ static void run_autoexec(const char *filename)
         net_pump();
         if(uart_check_cancel_key()){
             printf("(cancelled)\n");
-            return;
+            return true;
         }
     }
 
     strcpy(cmd_buffer, filename);
     execute_cmd(cmd_buffer);
+    return true;
 }
 
 void command_line_interpreter(void)
@@ -409,8 +466,9 @@ void command_line_interpreter(void)
     /* setup default environment */
     set_environment_variable("base", "16");
 
-    /* check for autoexec file */
-    run_autoexec(AUTOBOOT_FILENAME);
+    /* check for autoexec file, otherwise try the boot file named by DHCP */
+    if(!run_autoexec(AUTOBOOT_FILENAME))
+        netboot(true);
 
     while(true){
         f_getcwd(cmd_buffer, LINELEN);
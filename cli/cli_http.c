@@ -0,0 +1,48 @@
+/* Copyright (C) 2015-2023 William R. Sowerbutts */
+
+#include <types.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <cli.h>
+#include <net.h>
+
+void do_http_get(char *argv[], int argc)
+{
+    const char *url, *dst, *end;
+    bool resume = false;
+
+    if(argc >= 1 && strcmp(argv[0], "-c") == 0){
+        resume = true;
+        argv++;
+        argc--;
+    }
+
+    switch(argc){
+        case 1:
+            url = argv[0];
+            // save under the last component of the path
+            dst = url;
+            for(end = url; *end; end++)
+                if(*end == '/')
+                    dst = end + 1;
+            if(!*dst){
+                printf("please specify a destination file name\n");
+                return;
+            }
+            break;
+        case 2:
+            url = argv[0];
+            dst = argv[1];
+            break;
+        default:
+            printf("Unexpected number of arguments\n");
+            return;
+    }
+
+    http_transfer(url, dst, resume);
+}
+
+void do_http_load(char *argv[], int argc)
+{
+    http_load(argv[0], parse_uint32(argv[1], NULL), NULL);
+}
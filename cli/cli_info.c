@@ -4,9 +4,13 @@
 #include <stdlib.h>
 #include <cli.h>
 #include <net.h>
+#include <disk.h>
+#include <fatfs/ff.h>
+#include <version.h>
 #include <init.h>
 #include <tinyalloc.h>
 #include <rtc.h>
+#include <timers.h>
 
 static void help_cmd_table(const cmd_entry_t *cmd)
 {
@@ -34,6 +38,17 @@ void do_netinfo(char *argv[], int argc)
 {
     int prefixlen = 0;
     uint32_t mask = interface_subnet_mask;
+
+    if(argc == 1){
+        if(strcasecmp(argv[0], "reset")){
+            printf("usage: netinfo [reset]\n");
+            return;
+        }
+        net_reset_stats();
+        printf("network statistics reset\n");
+        return;
+    }
+
     while(mask){
         prefixlen++;
         mask <<= 1;
@@ -59,12 +74,317 @@ void do_netinfo(char *argv[], int argc)
     printf("packet_rx_count %ld\n", packet_rx_count);
     printf("packet_tx_count %ld\n", packet_tx_count);
     printf("packet_alive_count %ld\n", packet_alive_count);
+    printf("packet_pool_size %d\n", packet_pool_size);
+    printf("packet_pool_high_water %ld\n", packet_pool_high_water);
+    printf("packet_pool_exhausted_count %ld\n", packet_pool_exhausted_count);
     printf("packet_discard_count %ld\n", packet_discard_count);
-    printf("packet_bad_cksum_count %ld\n", packet_bad_cksum_count);
+    printf("packet_bad_cksum_count %ld (ipv4 %ld, udp %ld, tcp %ld, icmp %ld, igmp %ld)\n", packet_bad_cksum_count,
+            packet_bad_ipv4_cksum_count, packet_bad_udp_cksum_count,
+            packet_bad_tcp_cksum_count, packet_bad_icmp_cksum_count,
+            packet_bad_igmp_cksum_count);
+    printf("packet_txqueue_length %d (max %d)\n", packet_txqueue_length, packet_txqueue_high_water);
 
+    eth_dump_stats();
+    net_histogram_print("tftp ack round trip", &tftp_ack_rtt_histogram);
+    net_arp_dump_cache();
     net_dump_packet_sinks();
 }
 
+void do_netcap(char *argv[], int argc)
+{
+    if(argc == 0){
+        netcap_status();
+    }else if(!strcasecmp(argv[0], "start") && argc <= 3){
+        netcap_start(argc > 1 ? atoi(argv[1]) : 0, // decimal, whatever "base" is
+                     argc > 2 ? atoi(argv[2]) : 0);
+    }else if(!strcasecmp(argv[0], "stop") && argc == 1){
+        netcap_stop();
+        netcap_status();
+    }else if(!strcasecmp(argv[0], "save") && argc == 2){
+        netcap_save(argv[1]);
+    }else{
+        printf("usage: netcap [start [kbytes [snaplen]] | stop | save filename]\n");
+    }
+}
+
+void do_diskcache(char *argv[], int argc)
+{
+    if(argc == 0){
+        disk_cache_status();
+    }else if(!strcasecmp(argv[0], "reset")){
+        disk_cache_reset_stats();
+        printf("disk cache statistics reset\n");
+    }else if(!strcasecmp(argv[0], "drop")){
+        if(disk_cache_drop())
+            printf("disk cache dropped\n");
+    }else{
+        printf("usage: diskcache [reset | drop]\n");
+    }
+}
+
+#define CKSUMBENCH_TICKS (TIMER_HZ/2)   /* run each variant for this long */
+
+typedef struct {
+    const char *name;
+    uint32_t (*update)(uint32_t sum, const void *addr, unsigned int count);
+} cksum_variant_t;
+
+static const cksum_variant_t cksum_variants[] = {
+    { "asm", net_checksum_update },
+    { "c",   net_checksum_update_c },
+};
+
+void do_cksumbench(char *argv[], int argc)
+{
+    uint8_t *buffer;
+    unsigned int length = 1472; /* largest UDP payload in a full sized frame */
+    uint32_t bytes, ticks;
+    uint16_t result;
+    timer_t start, now;
+    int i, v;
+
+    if(argc > 0)
+        length = parse_uint32(argv[0], NULL);
+
+    if(length == 0 || length > 65536){
+        printf("cksumbench: length must be 1 to 65536 bytes\n");
+        return;
+    }
+
+    buffer = malloc(length);
+    if(!buffer){
+        printf("cksumbench: cannot allocate %d bytes\n", length);
+        return;
+    }
+
+    for(i=0; i<length; i++)
+        buffer[i] = (i * 7) ^ (i >> 8);
+
+    for(v=0; v<sizeof(cksum_variants)/sizeof(cksum_variants[0]); v++){
+        bytes = 0;
+        /* wait for a tick boundary so we measure whole ticks */
+        now = gogoboot_read_timer();
+        while((start = gogoboot_read_timer()) == now);
+        do{
+            result = net_checksum_fold(cksum_variants[v].update(0, buffer, length));
+            bytes += length;
+            now = gogoboot_read_timer();
+        }while(now - start < CKSUMBENCH_TICKS);
+        ticks = now - start;
+        printf("%s: %ld bytes/sec (%d byte blocks, sum 0x%04x)\n", cksum_variants[v].name,
+                bytes / ticks * TIMER_HZ, length, result);
+    }
+
+    free(buffer);
+}
+
+void do_rxbench(char *argv[], int argc)
+{
+    eth_rx_benchmark();
+}
+
+// Disk benchmark. The raw tests drive disk_data_read() and disk_data_write()
+// directly, beneath the sector cache, within the sectors of a contiguous
+// scratch file so that they cannot damage the filesystem; the file tests go
+// through FatFs, and so through the cache. Each test runs for about a
+// second. Every result is a single line of key=value pairs, so the logs from
+// different machines can be gathered with grep and compared.
+#define DISKBENCH_TICKS         TIMER_HZ        /* run each test for this long */
+#define DISKBENCH_KB            1024            /* default scratch file size */
+#define DISKBENCH_MIN_KB        64
+#define DISKBENCH_MAX_SECTORS   128             /* largest transfer */
+#define DISKBENCH_RANDOM_SECTORS 8              /* 4KB random transfers */
+#define DISKBENCH_FILENAME      "diskbench.tmp"
+
+static const int diskbench_raw_sectors[] = { 1, 8, 32, DISKBENCH_MAX_SECTORS };
+static const int diskbench_file_chunk[] = { 512, 4096, 32768 };
+
+typedef struct {
+    int drive;
+    uint32_t base;              /* first sector of the scratch file */
+    uint32_t sectors;           /* sectors in the scratch file */
+    uint8_t *buffer;
+    uint32_t random;
+} diskbench_t;
+
+static timer_t diskbench_start(void)
+{
+    timer_t now, start;
+
+    /* wait for a tick boundary so we measure whole ticks */
+    now = gogoboot_read_timer();
+    while((start = gogoboot_read_timer()) == now);
+    return start;
+}
+
+static void diskbench_report(diskbench_t *bench, const char *test, int xfer, uint32_t ops, uint32_t bytes, timer_t ticks)
+{
+    uint32_t ms = ticks * TIMER_MS_PER_TICK;
+
+    if(ms == 0)
+        ms = 1; // avoid div 0
+    printf("diskbench drive=%d test=%s xfer=%d ops=%ld bytes=%ld ms=%ld kib_per_sec=%ld iops=%ld\n",
+            bench->drive, test, xfer, ops, bytes, ms, (bytes / 16) * 1000 / ms / 64, ops * 1000 / ms);
+}
+
+static bool diskbench_raw(diskbench_t *bench, int sectors, bool is_write, bool random)
+{
+    uint32_t offset = 0, ops = 0;
+    timer_t start, now;
+    bool ok;
+
+    start = diskbench_start();
+    do{
+        if(random){
+            bench->random = bench->random * 1103515245 + 12345;
+            offset = ((bench->random >> 8) % (bench->sectors / sectors)) * sectors;
+        }else if(offset + sectors > bench->sectors)
+            offset = 0;
+        if(is_write)
+            ok = disk_data_write(bench->drive, bench->buffer, bench->base + offset, sectors);
+        else
+            ok = disk_data_read(bench->drive, bench->buffer, bench->base + offset, sectors);
+        if(!ok){
+            printf("diskbench: %s failed at sector %lu\n", is_write ? "write" : "read", bench->base + offset);
+            return false;
+        }
+        if(!random)
+            offset += sectors;
+        ops++;
+        now = gogoboot_read_timer();
+    }while(now - start < DISKBENCH_TICKS);
+
+    diskbench_report(bench, random ? (is_write ? "raw_random_write" : "raw_random_read")
+                                   : (is_write ? "raw_seq_write" : "raw_seq_read"),
+                     sectors * 512, ops, ops * sectors * 512, now - start);
+    return true;
+}
+
+static bool diskbench_file(diskbench_t *bench, FIL *fd, int chunk, bool is_write)
+{
+    uint32_t ops = 0;
+    timer_t start, now;
+    FRESULT fr;
+    UINT done;
+
+    fr = f_lseek(fd, 0);
+    start = diskbench_start();
+    do{
+        if(fr == FR_OK && f_tell(fd) + chunk > bench->sectors * 512)
+            fr = f_lseek(fd, 0);
+        if(fr == FR_OK){
+            if(is_write)
+                fr = f_write(fd, bench->buffer, chunk, &done);
+            else
+                fr = f_read(fd, bench->buffer, chunk, &done);
+            if(fr == FR_OK && done != chunk)
+                fr = FR_DISK_ERR;
+        }
+        if(fr != FR_OK)
+            break;
+        ops++;
+        now = gogoboot_read_timer();
+    }while(now - start < DISKBENCH_TICKS);
+
+    /* writes are not done until they are on the disk */
+    if(fr == FR_OK && is_write)
+        fr = f_sync(fd);
+    now = gogoboot_read_timer();
+
+    if(fr != FR_OK){
+        printf("diskbench: f_%s: ", is_write ? "write" : "read");
+        f_perror(fr);
+        return false;
+    }
+
+    diskbench_report(bench, is_write ? "file_write" : "file_read", chunk, ops, ops * chunk, now - start);
+    return true;
+}
+
+void do_diskbench(char *argv[], int argc)
+{
+    diskbench_t bench;
+    disk_t *disk;
+    FATFS *fs;
+    FIL fd;
+    FRESULT fr;
+    char path[2 + sizeof(DISKBENCH_FILENAME)];
+    int kbytes = DISKBENCH_KB, i;
+    bool ok = true;
+
+    bench.drive = argc > 0 ? atoi(argv[0]) : 0; // decimal, whatever "base" is
+    if(argc > 1)
+        kbytes = atoi(argv[1]);
+
+    disk = disk_get_info(bench.drive);
+    if(!disk){
+        printf("diskbench: no disk %d\n", bench.drive);
+        return;
+    }
+    if(kbytes < DISKBENCH_MIN_KB){
+        printf("diskbench: at least %d KB please\n", DISKBENCH_MIN_KB);
+        return;
+    }
+
+    bench.buffer = malloc_unchecked(DISKBENCH_MAX_SECTORS * 512);
+    if(!bench.buffer){
+        printf("diskbench: cannot allocate %d bytes\n", DISKBENCH_MAX_SECTORS * 512);
+        return;
+    }
+    for(i=0; i<DISKBENCH_MAX_SECTORS * 512; i++)
+        bench.buffer[i] = (i * 7) ^ (i >> 8);
+    bench.random = 1;
+
+    /* the scratch file is allocated in one piece so we know where it lies */
+    path[0] = '0' + bench.drive;
+    path[1] = ':';
+    strcpy(path + 2, DISKBENCH_FILENAME);
+    fr = f_open(&fd, path, FA_READ | FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr == FR_OK){
+        fr = f_expand(&fd, (FSIZE_t)kbytes << 10, 1);
+        if(fr != FR_OK){
+            f_close(&fd);
+            f_unlink(path);
+        }
+    }
+    if(fr == FR_OK)
+        fr = f_sync(&fd);
+    if(fr != FR_OK){
+        printf("diskbench: cannot create %s: ", path);
+        f_perror(fr);
+        free(bench.buffer);
+        return;
+    }
+
+    fs = fd.obj.fs;
+    bench.base = fs->database + (fd.obj.sclust - 2) * fs->csize;
+    bench.sectors = (uint32_t)kbytes << 1;
+
+    printf("diskbench version=%s drive=%d sectors=%ld multiple=%d scratch_kb=%d\n",
+            software_version_string, bench.drive, disk->sectors, disk->multiple, kbytes);
+
+    for(i=0; ok && i<sizeof(diskbench_raw_sectors)/sizeof(diskbench_raw_sectors[0]); i++)
+        ok = diskbench_raw(&bench, diskbench_raw_sectors[i], false, false);
+    for(i=0; ok && i<sizeof(diskbench_raw_sectors)/sizeof(diskbench_raw_sectors[0]); i++)
+        ok = diskbench_raw(&bench, diskbench_raw_sectors[i], true, false);
+    if(ok)
+        ok = diskbench_raw(&bench, DISKBENCH_RANDOM_SECTORS, false, true);
+    if(ok)
+        ok = diskbench_raw(&bench, DISKBENCH_RANDOM_SECTORS, true, true);
+
+    /* the raw writes went around the cache */
+    disk_cache_invalidate(bench.drive, bench.base, bench.sectors);
+
+    for(i=0; ok && i<sizeof(diskbench_file_chunk)/sizeof(diskbench_file_chunk[0]); i++)
+        ok = diskbench_file(&bench, &fd, diskbench_file_chunk[i], true);
+    for(i=0; ok && i<sizeof(diskbench_file_chunk)/sizeof(diskbench_file_chunk[0]); i++)
+        ok = diskbench_file(&bench, &fd, diskbench_file_chunk[i], false);
+
+    f_close(&fd);
+    f_unlink(path);
+    free(bench.buffer);
+}
+
 void do_date(char *argv[], int argc)
 {
 	report_current_time();
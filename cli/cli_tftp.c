@@ -5,6 +5,9 @@
 #include <stdbool.h>
 #include <cli.h>
 #include <net.h>
+#include <loader.h>
+#include <timers.h>
+#include <uart.h>
 
 void do_tftp_cli(char *argv[], int argc, bool is_put)
 {
@@ -63,3 +66,120 @@ void do_tftp_put(char *argv[], int argc)
 {
     do_tftp_cli(argv, argc, true);
 }
+
+void do_tftp_load(char *argv[], int argc)
+{
+    const char *server=NULL, *src;
+    uint32_t targetip, address;
+
+    if(argc == 3){
+        server = argv[0];
+        argv++;
+    }else
+        server = get_environment_variable("tftp_server");
+
+    src = argv[0];
+    address = parse_uint32(argv[1], NULL);
+
+    if(!server){
+        printf("please specify the server IP address (or 'set tftp_server <ip>')\n");
+        return;
+    }
+
+    targetip = net_parse_ipv4(server);
+    if(targetip == 0){
+        printf("Cannot parse server IPv4 address \"%s\"\n", server);
+        return;
+    }
+
+    tftp_load(targetip, src, address, NULL);
+}
+
+void do_tftp_boot(char *argv[], int argc)
+{
+    const char *server = NULL;
+    uint32_t targetip;
+
+    /* optional leading server IP, then the ELF file name and its arguments */
+    if(argc >= 2 && net_parse_ipv4(argv[0]) != 0){
+        server = argv[0];
+        argv++;
+        argc--;
+    }else
+        server = get_environment_variable("tftp_server");
+
+    if(!server){
+        printf("please specify the server IP address (or 'set tftp_server <ip>')\n");
+        return;
+    }
+
+    targetip = net_parse_ipv4(server);
+    if(targetip == 0){
+        printf("Cannot parse server IPv4 address \"%s\"\n", server);
+        return;
+    }
+
+    load_elf_executable_tftp(argv, argc, targetip, argv[0]);
+}
+
+#define NETBOOT_DHCP_TIMEOUT_MS 20000 /* DHCP gives up on an offer after 5s, so this allows a few tries */
+#define NETBOOT_TIMEOUT_MS 500
+
+/* fetch the boot file named by DHCP and run it. when autobooting, give up
+ * quietly if there is no network, and allow the user to cancel. */
+bool netboot(bool autoboot)
+{
+    timer_t timer;
+    char server[16];
+
+    if(!dhcp_enabled()){
+        if(!autoboot)
+            printf("netboot: no network interface\n");
+        return false;
+    }
+
+    if(!interface_ipv4_address){
+        printf("Waiting for DHCP (hit Q to cancel)\n");
+        timer = set_timer_ms(NETBOOT_DHCP_TIMEOUT_MS);
+        while(!interface_ipv4_address){
+            net_pump();
+            if(uart_check_cancel_key()){
+                printf("(cancelled)\n");
+                return false;
+            }
+            if(timer_expired(timer)){
+                printf("netboot: no DHCP lease\n");
+                return false;
+            }
+        }
+    }
+
+    if(!interface_boot_file[0] || !interface_boot_server){
+        printf("netboot: DHCP did not name a boot file and server\n");
+        return false;
+    }
+
+    /* make the boot server the default for any tftp commands a boot script runs */
+    net_format_ipv4(server, interface_boot_server);
+    if(!get_environment_variable("tftp_server"))
+        set_environment_variable("tftp_server", server);
+
+    if(autoboot){
+        timer = set_timer_ms(NETBOOT_TIMEOUT_MS);
+        printf("Booting \"%s\" from %s (hit Q to cancel)\n", interface_boot_file, server);
+        while(!timer_expired(timer)){
+            net_pump();
+            if(uart_check_cancel_key()){
+                printf("(cancelled)\n");
+                return false;
+            }
+        }
+    }
+
+    return load_netboot_tftp(interface_boot_server, interface_boot_file);
+}
+
+void do_netboot(char *argv[], int argc)
+{
+    netboot(false);
+}
@@ -99,16 +99,17 @@ void gogoboot(void)
     rtc_init();
     report_current_time();
 
-    disk_init();
-
-    target_hardware_init();
-
+    /* start DHCP first: the exchange then proceeds while we probe the disks */
     printf("Initialise ethernet: ");
     net_init();
     if(eth_init()){
         dhcp_init();
     }
 
+    disk_init();
+
+    target_hardware_init();
+
     command_line_interpreter();
 
     // should not get here
@@ -0,0 +1,615 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <cli.h>
+#include <disk.h>
+
+// Sector cache between FatFs and the IDE driver.
+//
+// FatFs keeps a single sector window per volume, and goes back to the disk
+// each time it needs a different FAT or directory sector, so path lookups,
+// directory listings and cluster chain walks read the same few sectors over
+// and over. The cache keeps recently used sectors in the heap, on a separate
+// LRU list for each kind of sector:
+//  - FAT sectors, recognised by their position on the volume
+//  - directory sectors, the other sectors FatFs reads into its window
+//  - file data, which we cache only when a file is being read sequentially,
+//    and then read ahead in a single multi-sector command
+// A slot for a new sector comes from the free list, else from file data, so
+// that reading a large file cannot flush the metadata, else from directory
+// sectors, and only then from the FAT. File data may take slots back from
+// the metadata while that holds more than three quarters of the cache, and
+// the FAT is not protected once it holds more than half.
+//
+// Small writes are held in the cache and marked dirty; FatFs writes file data
+// and metadata a sector at a time, and otherwise each one would cost a
+// command and a wait for the drive. Dirty sectors are written out, sorted so
+// that adjacent sectors are merged into one multi-sector command, when
+// FatFs asks for CTRL_SYNC (f_sync, f_close, and after any change to a
+// directory), before execute() hands the machine to another program, when
+// the cache is dropped, when a dirty slot is needed for another sector, and
+// when half the cache is dirty. After a sync we also ask the drive to flush
+// its own write cache. Large writes go straight to the disk, updating any
+// cached copy.
+//
+// The size is taken from the disk_cache environment variable, in KB, when
+// the cache is first used; 0 turns it off. Set disk_writeback to 0 to write
+// everything through to the disk at once; we also fall back to that if
+// writing back fails. "diskcache drop" discards the cache so new settings
+// take effect.
+
+#define DISK_CACHE_KB           32      // default size
+#define DISK_CACHE_READAHEAD    16      // sectors, at most
+#define DISK_CACHE_BATCH        64      // sectors, at most, in one read-ahead or write-back command
+#define DISK_CACHE_MIN_SECTORS  8
+
+#define SECTOR_SIZE             512
+#define NO_ENTRY                (-1)
+
+typedef struct {
+    uint32_t sector;
+    uint8_t disk;
+    uint8_t kind;               // which LRU list the entry is on
+    bool dirty;                 // to be written back
+    int16_t hash_next;
+    int16_t prev, next;         // LRU list, most recently used at the head
+} disk_cache_entry_t;
+
+typedef struct {
+    int16_t head, tail;
+    int count;
+} disk_cache_list_t;
+
+static bool disk_cache_ready = false;  // set up has been attempted
+static int disk_cache_sectors = 0;     // 0: cache is off
+static int disk_cache_readahead;
+static int disk_cache_batch;           // sectors in the staging buffer
+static bool disk_cache_writeback;
+static int disk_cache_dirty;           // dirty sectors
+static int disk_cache_hash_mask;
+static disk_cache_entry_t *disk_cache_entry;
+static int16_t *disk_cache_hash;
+static uint8_t *disk_cache_data;
+static uint8_t *disk_cache_staging;    // read-ahead lands here before it is sorted into slots, write-back is gathered here
+static int16_t *disk_cache_order;      // dirty entries, sorted for write-back
+static disk_cache_list_t disk_cache_list[DISK_CACHE_KINDS];
+static int16_t disk_cache_free;        // free entries, chained through next
+
+// sequential stream detection, per disk
+static uint32_t disk_cache_next_sector[FF_VOLUMES];
+
+disk_cache_stats_t disk_cache_stats;
+
+static const char * const disk_cache_kind_name[DISK_CACHE_KINDS] = { "fat", "dir", "data" };
+
+static uint8_t *disk_cache_sector_data(int e)
+{
+    return disk_cache_data + e * SECTOR_SIZE;
+}
+
+static int disk_cache_hash_bucket(int disk, uint32_t sector)
+{
+    return (sector ^ (disk << 4)) & disk_cache_hash_mask;
+}
+
+static int disk_cache_lookup(int disk, uint32_t sector)
+{
+    int e;
+
+    for(e = disk_cache_hash[disk_cache_hash_bucket(disk, sector)]; e != NO_ENTRY; e = disk_cache_entry[e].hash_next)
+        if(disk_cache_entry[e].sector == sector && disk_cache_entry[e].disk == disk)
+            return e;
+
+    return NO_ENTRY;
+}
+
+static void disk_cache_hash_remove(int e)
+{
+    int16_t *link = &disk_cache_hash[disk_cache_hash_bucket(disk_cache_entry[e].disk, disk_cache_entry[e].sector)];
+
+    while(*link != e)
+        link = &disk_cache_entry[*link].hash_next;
+    *link = disk_cache_entry[e].hash_next;
+}
+
+static void disk_cache_list_remove(int e)
+{
+    disk_cache_entry_t *entry = &disk_cache_entry[e];
+    disk_cache_list_t *list = &disk_cache_list[entry->kind];
+
+    if(entry->prev == NO_ENTRY)
+        list->head = entry->next;
+    else
+        disk_cache_entry[entry->prev].next = entry->next;
+    if(entry->next == NO_ENTRY)
+        list->tail = entry->prev;
+    else
+        disk_cache_entry[entry->next].prev = entry->prev;
+    list->count--;
+}
+
+static void disk_cache_list_add_head(int e)
+{
+    disk_cache_entry_t *entry = &disk_cache_entry[e];
+    disk_cache_list_t *list = &disk_cache_list[entry->kind];
+
+    entry->prev = NO_ENTRY;
+    entry->next = list->head;
+    if(list->head == NO_ENTRY)
+        list->tail = e;
+    else
+        disk_cache_entry[list->head].prev = e;
+    list->head = e;
+    list->count++;
+}
+
+static void disk_cache_list_add_tail(int e)
+{
+    disk_cache_entry_t *entry = &disk_cache_entry[e];
+    disk_cache_list_t *list = &disk_cache_list[entry->kind];
+
+    entry->next = NO_ENTRY;
+    entry->prev = list->tail;
+    if(list->tail == NO_ENTRY)
+        list->head = e;
+    else
+        disk_cache_entry[list->tail].next = e;
+    list->tail = e;
+    list->count++;
+}
+
+static int disk_cache_pick_victim(int kind)
+{
+    int meta = disk_cache_list[DISK_CACHE_FAT].count + disk_cache_list[DISK_CACHE_DIR].count;
+
+    if(disk_cache_list[DISK_CACHE_DATA].count &&
+       (kind != DISK_CACHE_DATA || meta <= disk_cache_sectors * 3 / 4))
+        return disk_cache_list[DISK_CACHE_DATA].tail;
+    if(kind == DISK_CACHE_DATA && meta <= disk_cache_sectors * 3 / 4)
+        return NO_ENTRY; // leave the metadata be
+    if(disk_cache_list[DISK_CACHE_DIR].count &&
+       disk_cache_list[DISK_CACHE_FAT].count <= disk_cache_sectors / 2)
+        return disk_cache_list[DISK_CACHE_DIR].tail;
+    if(disk_cache_list[DISK_CACHE_FAT].count)
+        return disk_cache_list[DISK_CACHE_FAT].tail;
+    return disk_cache_list[DISK_CACHE_DIR].tail;
+}
+
+static int disk_cache_compare_sector(const void *a, const void *b)
+{
+    uint32_t sa = disk_cache_entry[*(const int16_t*)a].sector;
+    uint32_t sb = disk_cache_entry[*(const int16_t*)b].sector;
+
+    return sa < sb ? -1 : sa > sb ? 1 : 0;
+}
+
+// write back the dirty sectors of one disk, merging runs of adjacent sectors
+static bool disk_cache_flush_disk(int disknr)
+{
+    disk_cache_entry_t *first;
+    const uint8_t *buff;
+    int count = 0, run;
+
+    for(int e=0; e<disk_cache_sectors; e++)
+        if(disk_cache_entry[e].dirty && disk_cache_entry[e].disk == disknr)
+            disk_cache_order[count++] = e;
+    if(!count)
+        return true;
+
+    qsort(disk_cache_order, count, sizeof(int16_t), disk_cache_compare_sector);
+
+    for(int i=0; i<count; i += run){
+        first = &disk_cache_entry[disk_cache_order[i]];
+        for(run=1; i+run < count && run < disk_cache_batch &&
+                   disk_cache_entry[disk_cache_order[i+run]].sector == first->sector + run; run++);
+
+        if(run == 1)
+            buff = disk_cache_sector_data(disk_cache_order[i]);
+        else{
+            for(int j=0; j<run; j++)
+                memcpy(disk_cache_staging + j * SECTOR_SIZE, disk_cache_sector_data(disk_cache_order[i+j]), SECTOR_SIZE);
+            buff = disk_cache_staging;
+        }
+
+        if(!disk_data_write(disknr, buff, first->sector, run)){
+            printf("disk %d: write back failed at sector %lu, cache is now write-through\n", disknr, first->sector);
+            disk_cache_writeback = false;
+            return false;
+        }
+
+        for(int j=0; j<run; j++)
+            disk_cache_entry[disk_cache_order[i+j]].dirty = false;
+        disk_cache_dirty -= run;
+        disk_cache_stats.writeback += run;
+        disk_cache_stats.writeback_commands++;
+    }
+
+    return true;
+}
+
+// find a slot for a sector that is not in the cache; NO_ENTRY if there is
+// none to spare, or if it would mean writing back and may_flush is false
+static int disk_cache_allocate(int disk, uint32_t sector, int kind, bool may_flush)
+{
+    int e;
+
+    if(disk_cache_free != NO_ENTRY){
+        e = disk_cache_free;
+        disk_cache_free = disk_cache_entry[e].next;
+    }else{
+        e = disk_cache_pick_victim(kind);
+        if(e == NO_ENTRY)
+            return NO_ENTRY;
+        if(disk_cache_entry[e].dirty)
+            if(!may_flush || !disk_cache_flush_disk(disk_cache_entry[e].disk))
+                return NO_ENTRY;
+        disk_cache_list_remove(e);
+        disk_cache_hash_remove(e);
+        disk_cache_stats.evictions++;
+    }
+
+    disk_cache_entry[e].disk = disk;
+    disk_cache_entry[e].sector = sector;
+    disk_cache_entry[e].kind = kind;
+    disk_cache_entry[e].dirty = false;
+    disk_cache_list_add_head(e);
+    disk_cache_entry[e].hash_next = disk_cache_hash[disk_cache_hash_bucket(disk, sector)];
+    disk_cache_hash[disk_cache_hash_bucket(disk, sector)] = e;
+
+    return e;
+}
+
+static void disk_cache_touch(int e, int kind)
+{
+    disk_cache_list_remove(e);
+    disk_cache_entry[e].kind = kind;
+    if(kind == DISK_CACHE_DATA)
+        disk_cache_list_add_tail(e); // read ahead data is rarely wanted twice
+    else
+        disk_cache_list_add_head(e);
+}
+
+static void disk_cache_free_memory(void)
+{
+    free(disk_cache_data);
+    free(disk_cache_staging);
+    free(disk_cache_entry);
+    free(disk_cache_order);
+    free(disk_cache_hash);
+}
+
+static void disk_cache_setup(void)
+{
+    int kbytes, buckets = 16;
+
+    disk_cache_ready = true;
+    kbytes = get_environment_variable_int("disk_cache", DISK_CACHE_KB);
+    disk_cache_writeback = get_environment_variable_int("disk_writeback", 1);
+
+    // fall back to a smaller cache, and finally none, when the heap is small
+    for(disk_cache_sectors = kbytes * (1024 / SECTOR_SIZE);
+        disk_cache_sectors >= DISK_CACHE_MIN_SECTORS; disk_cache_sectors /= 2){
+        if(disk_cache_sectors > 0x7fff)
+            continue;
+        disk_cache_batch = disk_cache_sectors / 4;
+        if(disk_cache_batch > DISK_CACHE_BATCH)
+            disk_cache_batch = DISK_CACHE_BATCH;
+        disk_cache_readahead = disk_cache_batch;
+        if(disk_cache_readahead > DISK_CACHE_READAHEAD)
+            disk_cache_readahead = DISK_CACHE_READAHEAD;
+        for(buckets = 16; buckets < disk_cache_sectors / 2; buckets *= 2);
+        disk_cache_data = malloc_unchecked(disk_cache_sectors * SECTOR_SIZE);
+        disk_cache_staging = malloc_unchecked(disk_cache_batch * SECTOR_SIZE);
+        disk_cache_entry = malloc_unchecked(disk_cache_sectors * sizeof(disk_cache_entry_t));
+        disk_cache_order = malloc_unchecked(disk_cache_sectors * sizeof(int16_t));
+        disk_cache_hash = malloc_unchecked(buckets * sizeof(int16_t));
+        if(disk_cache_data && disk_cache_staging && disk_cache_entry && disk_cache_order && disk_cache_hash)
+            break;
+        disk_cache_free_memory();
+    }
+
+    if(disk_cache_sectors < DISK_CACHE_MIN_SECTORS){
+        disk_cache_sectors = 0;
+        return;
+    }
+
+    disk_cache_hash_mask = buckets - 1;
+    for(int i=0; i<buckets; i++)
+        disk_cache_hash[i] = NO_ENTRY;
+    for(int k=0; k<DISK_CACHE_KINDS; k++){
+        disk_cache_list[k].head = disk_cache_list[k].tail = NO_ENTRY;
+        disk_cache_list[k].count = 0;
+    }
+    for(int e=0; e<disk_cache_sectors; e++){
+        disk_cache_entry[e].next = (e + 1 < disk_cache_sectors) ? e + 1 : NO_ENTRY;
+        disk_cache_entry[e].dirty = false;
+    }
+    disk_cache_free = 0;
+    disk_cache_dirty = 0;
+    for(int d=0; d<FF_VOLUMES; d++)
+        disk_cache_next_sector[d] = ~0;
+}
+
+static bool disk_cache_active(void)
+{
+    if(!disk_cache_ready)
+        disk_cache_setup();
+    return disk_cache_sectors > 0;
+}
+
+// FatFs reads and writes metadata through its window, so the buffer tells us
+// which sectors are FAT or directory sectors, and the volume layout which of
+// those are FAT
+static int disk_cache_kind(int disknr, const void *buff, uint32_t sector)
+{
+    disk_t *disk = disk_get_info(disknr);
+    FATFS *fs;
+
+    if(!disk)
+        return DISK_CACHE_DATA;
+    fs = &disk->fat_fs_workarea;
+    if(buff != fs->win)
+        return DISK_CACHE_DATA;
+    if(fs->fs_type && sector >= fs->fatbase && sector - fs->fatbase < fs->fsize * fs->n_fats)
+        return DISK_CACHE_FAT;
+    return DISK_CACHE_DIR;
+}
+
+// a read from the disk may be older than sectors waiting to be written back
+static void disk_cache_overlay_dirty(int disknr, uint8_t *buff, uint32_t sector, int sector_count)
+{
+    int e;
+
+    if(!disk_cache_dirty)
+        return;
+
+    for(; sector_count > 0; sector_count--, sector++, buff += SECTOR_SIZE){
+        e = disk_cache_lookup(disknr, sector);
+        if(e != NO_ENTRY && disk_cache_entry[e].dirty)
+            memcpy(buff, disk_cache_sector_data(e), SECTOR_SIZE);
+    }
+}
+
+static bool disk_cache_read_uncached(int disknr, uint8_t *buff, uint32_t sector, int sector_count)
+{
+    disk_cache_stats.uncached += sector_count;
+    if(!disk_data_read(disknr, buff, sector, sector_count))
+        return false;
+    disk_cache_overlay_dirty(disknr, buff, sector, sector_count);
+    return true;
+}
+
+// read ahead from sector, which is not in the cache, returning the first count sectors
+static bool disk_cache_read_ahead(int disknr, uint8_t *buff, uint32_t sector, int count)
+{
+    disk_t *disk = disk_get_info(disknr);
+    int length = disk_cache_readahead, e;
+
+    if(sector + length > disk->sectors)
+        length = disk->sectors - sector;
+    if(length <= count)
+        return disk_cache_read_uncached(disknr, buff, sector, count);
+
+    if(!disk_data_read(disknr, disk_cache_staging, sector, length))
+        return false;
+    memcpy(buff, disk_cache_staging, count * SECTOR_SIZE);
+    disk_cache_overlay_dirty(disknr, buff, sector, count);
+
+    // sectors already in the cache keep their copy, which may be newer
+    for(int i=count; i<length; i++){
+        if(disk_cache_lookup(disknr, sector + i) != NO_ENTRY)
+            continue;
+        e = disk_cache_allocate(disknr, sector + i, DISK_CACHE_DATA, false); // staging is in use
+        if(e == NO_ENTRY)
+            break;
+        memcpy(disk_cache_sector_data(e), disk_cache_staging + i * SECTOR_SIZE, SECTOR_SIZE);
+        disk_cache_stats.readahead++;
+    }
+    return true;
+}
+
+bool disk_cache_read(int disknr, void *buff, uint32_t sector, int sector_count)
+{
+    uint8_t *dest = buff;
+    int kind, e;
+    bool sequential;
+
+    if(!disk_cache_active() || !disk_get_info(disknr))
+        return disk_data_read(disknr, buff, sector, sector_count);
+
+    kind = disk_cache_kind(disknr, buff, sector);
+    if(kind == DISK_CACHE_DATA){
+        sequential = (sector == disk_cache_next_sector[disknr]);
+        disk_cache_next_sector[disknr] = sector + sector_count;
+        if(sector_count > disk_cache_readahead) // large transfers go straight to the caller's buffer
+            return disk_cache_read_uncached(disknr, dest, sector, sector_count);
+    }else
+        sequential = false;
+
+    while(sector_count > 0){
+        e = disk_cache_lookup(disknr, sector);
+        if(e == NO_ENTRY)
+            break;
+        memcpy(dest, disk_cache_sector_data(e), SECTOR_SIZE);
+        disk_cache_touch(e, kind);
+        disk_cache_stats.hits[kind]++;
+        dest += SECTOR_SIZE;
+        sector++;
+        sector_count--;
+    }
+
+    if(sector_count == 0)
+        return true;
+
+    disk_cache_stats.misses[kind] += sector_count;
+
+    if(kind != DISK_CACHE_DATA){
+        // metadata comes one sector at a time, into the window
+        e = disk_cache_allocate(disknr, sector, kind, true);
+        if(e == NO_ENTRY)
+            return disk_cache_read_uncached(disknr, dest, sector, sector_count);
+        if(!disk_data_read(disknr, disk_cache_sector_data(e), sector, 1)){
+            disk_cache_invalidate(disknr, sector, 1);
+            return false;
+        }
+        memcpy(dest, disk_cache_sector_data(e), SECTOR_SIZE);
+        return true;
+    }
+
+    if(sequential)
+        return disk_cache_read_ahead(disknr, dest, sector, sector_count);
+
+    return disk_cache_read_uncached(disknr, dest, sector, sector_count);
+}
+
+static void disk_cache_clean(int e)
+{
+    if(disk_cache_entry[e].dirty){
+        disk_cache_entry[e].dirty = false;
+        disk_cache_dirty--;
+    }
+}
+
+// hold small writes in the cache; returns the number of sectors taken
+static int disk_cache_write_back(int disknr, const uint8_t *src, uint32_t sector, int sector_count, int kind)
+{
+    int e, done;
+
+    for(done=0; done<sector_count; done++, sector++, src += SECTOR_SIZE){
+        e = disk_cache_lookup(disknr, sector);
+        if(e == NO_ENTRY)
+            e = disk_cache_allocate(disknr, sector, kind, true);
+        if(e == NO_ENTRY)
+            break;
+        memcpy(disk_cache_sector_data(e), src, SECTOR_SIZE);
+        if(!disk_cache_entry[e].dirty){
+            disk_cache_entry[e].dirty = true;
+            disk_cache_dirty++;
+        }
+    }
+
+    return done;
+}
+
+bool disk_cache_write(int disknr, const void *buff, uint32_t sector, int sector_count)
+{
+    const uint8_t *src = buff;
+    int kind, e, done;
+
+    if(!disk_cache_active() || !disk_get_info(disknr))
+        return disk_data_write(disknr, buff, sector, sector_count);
+
+    kind = disk_cache_kind(disknr, buff, sector);
+    disk_cache_stats.writes += sector_count;
+
+    if(disk_cache_writeback && sector_count <= disk_cache_batch){
+        done = disk_cache_write_back(disknr, src, sector, sector_count, kind);
+        sector += done;
+        sector_count -= done;
+        src += done * SECTOR_SIZE;
+        if(disk_cache_dirty > disk_cache_sectors / 2 && !disk_cache_flush_disk(disknr))
+            return false;
+        if(sector_count == 0)
+            return true;
+    }
+
+    // write through
+    if(!disk_data_write(disknr, src, sector, sector_count)){
+        disk_cache_invalidate(disknr, sector, sector_count);
+        return false;
+    }
+
+    for(; sector_count > 0; sector_count--, sector++, src += SECTOR_SIZE){
+        e = disk_cache_lookup(disknr, sector);
+        if(e == NO_ENTRY && kind != DISK_CACHE_DATA) // metadata is read back soon after
+            e = disk_cache_allocate(disknr, sector, kind, true);
+        if(e != NO_ENTRY){
+            memcpy(disk_cache_sector_data(e), src, SECTOR_SIZE);
+            disk_cache_clean(e);
+        }
+    }
+
+    return true;
+}
+
+// write back, then have the drive write out its own cache
+bool disk_cache_sync(int disknr)
+{
+    bool ok = true;
+
+    if(disk_cache_sectors)
+        ok = disk_cache_flush_disk(disknr);
+
+    return disk_flush_cache(disknr) && ok;
+}
+
+bool disk_cache_sync_all(void)
+{
+    bool ok = true;
+
+    for(int d=0; d<disk_get_count(); d++)
+        if(!disk_cache_sync(d))
+            ok = false;
+
+    return ok;
+}
+
+void disk_cache_invalidate(int disknr, uint32_t sector, int sector_count)
+{
+    int e;
+
+    if(!disk_cache_sectors)
+        return;
+
+    for(; sector_count > 0; sector_count--, sector++){
+        e = disk_cache_lookup(disknr, sector);
+        if(e == NO_ENTRY)
+            continue;
+        disk_cache_clean(e);
+        disk_cache_list_remove(e);
+        disk_cache_hash_remove(e);
+        disk_cache_entry[e].next = disk_cache_free;
+        disk_cache_free = e;
+    }
+}
+
+bool disk_cache_drop(void)
+{
+    if(!disk_cache_sync_all() && disk_cache_dirty){
+        printf("disk cache: %d sectors could not be written back, not dropped\n", disk_cache_dirty);
+        return false;
+    }
+
+    if(disk_cache_sectors)
+        disk_cache_free_memory();
+    disk_cache_sectors = 0;
+    disk_cache_ready = false;
+    return true;
+}
+
+void disk_cache_reset_stats(void)
+{
+    memset(&disk_cache_stats, 0, sizeof(disk_cache_stats));
+}
+
+void disk_cache_status(void)
+{
+    if(!disk_cache_active()){
+        printf("disk cache: off\n");
+        return;
+    }
+
+    printf("disk cache: %d sectors (%d KB), read-ahead %d sectors, %s, %d dirty\n",
+            disk_cache_sectors, disk_cache_sectors * SECTOR_SIZE / 1024, disk_cache_readahead,
+            disk_cache_writeback ? "write-back" : "write-through", disk_cache_dirty);
+    printf("        cached     hits   misses\n");
+    for(int k=0; k<DISK_CACHE_KINDS; k++)
+        printf("%-6s %7d %8ld %8ld\n", disk_cache_kind_name[k], disk_cache_list[k].count,
+                disk_cache_stats.hits[k], disk_cache_stats.misses[k]);
+    printf("read ahead %ld sectors, uncached reads %ld sectors, writes %ld sectors, evictions %ld\n",
+            disk_cache_stats.readahead, disk_cache_stats.uncached,
+            disk_cache_stats.writes, disk_cache_stats.evictions);
+    printf("written back %ld sectors in %ld commands\n",
+            disk_cache_stats.writeback, disk_cache_stats.writeback_commands);
+}
@@ -47,7 +47,7 @@ static bool disk_data_readwrite(int disknr, void *buff, uint32_t sector, int sec
 {
     disk_t *disk;
     disk_controller_t *ctrl;
-    int nsect;
+    int nsect, block;
 
     if(disknr < 0 || disknr >= disk_table_size){
         printf("bad disk %d\n", disknr);
@@ -84,19 +84,23 @@ static bool disk_data_readwrite(int disknr, void *buff, uint32_t sector, int sec
             return false;
 
         /* send command */
-        ide_set_register(ctrl, ATA_REG_CMD, is_write ? IDE_CMD_WRITE_SECTOR : IDE_CMD_READ_SECTOR);
+        if(disk->multiple > 1)
+            ide_set_register(ctrl, ATA_REG_CMD, is_write ? IDE_CMD_WRITE_MULTIPLE : IDE_CMD_READ_MULTIPLE);
+        else
+            ide_set_register(ctrl, ATA_REG_CMD, is_write ? IDE_CMD_WRITE_SECTOR : IDE_CMD_READ_SECTOR);
 
-        /* read result */
+        /* transfer data; the drive asserts DRQ once per block of
+         * disk->multiple sectors, the last block may be short */
         while(nsect > 0){
-            /* unclear if we need to wait for DRQ on each sector? play it safe */
             if(!ide_wait_status(ctrl, IDE_STATUS_DATAREQUEST))
                 return false;
+            block = nsect < disk->multiple ? nsect : disk->multiple;
+            nsect -= block;
             if(is_write)
-                ide_transfer_sector_write(ctrl, buff);
+                ide_transfer_block_write(ctrl, buff, block);
             else
-                ide_transfer_sector_read(ctrl, buff);
-            buff += 512;
-            nsect--;
+                ide_transfer_block_read(ctrl, buff, block);
+            buff += block * 512;
         }
 
         if(is_write) /* wait for write operations to complete */
@@ -129,11 +133,34 @@ static void disk_data_read_name(const uint8_t *id, char *buffer, int offset, int
     *s = 0;
 }
 
+/* enable READ/WRITE MULTIPLE with the largest block the drive supports;
+ * returns the sectors per block, 1 if the drive will not do it */
+static int disk_set_multiple(disk_controller_t *ctrl, const uint8_t *id)
+{
+    int multiple, max = id[ATA_ID_MAX_MULTSECT]; /* low byte of word 47 */
+
+    if(max < 2)
+        return 1;
+
+    /* drives only reliably accept a power of two */
+    for(multiple = 2; multiple*2 <= max; multiple *= 2);
+
+    ide_set_register(ctrl, ATA_REG_NSECT, multiple);
+    ide_set_register(ctrl, ATA_REG_CMD, IDE_CMD_SET_MULTIPLE);
+    if(!ide_wait_status(ctrl, IDE_STATUS_READY))
+        return 1;
+
+    return multiple;
+}
+
 static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
 {
     uint8_t sel, buffer[512];
     char prod[1+ATA_ID_PROD_LEN];
     uint32_t sectors;
+    uint16_t command_set_2;
+    int multiple;
+    bool flush_cache;
 
     printf("  Probe disk %d: ", drivenr);
 
@@ -173,7 +200,16 @@ static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
     sectors = le32_to_cpu(*((uint32_t*)&buffer[ATA_ID_LBA_CAPACITY]));
     disk_data_read_name(buffer, prod,   ATA_ID_PROD,   ATA_ID_PROD_LEN);
 
-    printf("%s (%lu sectors, %lu MB)\n", prod, sectors, sectors>>11);
+    multiple = disk_set_multiple(ctrl, buffer);
+
+    /* word 83 is valid when bits 15:14 are 01; bit 12 is FLUSH CACHE */
+    command_set_2 = le16_to_cpu(*((uint16_t*)&buffer[ATA_ID_COMMAND_SET_2]));
+    flush_cache = (command_set_2 & 0xC000) == 0x4000 && (command_set_2 & 0x1000);
+
+    printf("%s (%lu sectors, %lu MB", prod, sectors, sectors>>11);
+    if(multiple > 1)
+        printf(", %d sectors per block", multiple);
+    printf(")\n");
 
 #ifdef ATA_DUMP_IDENTIFY_RESULT
     for(int i=0; i<512; i+=16){
@@ -199,6 +235,8 @@ static void disk_init_disk(disk_controller_t *ctrl, int drivenr)
         disk->ctrl = ctrl;
         disk->disk = drivenr;
         disk->sectors = sectors;
+        disk->multiple = multiple;
+        disk->flush_cache = flush_cache;
         disk->fat_fs_status = STA_NOINIT;
 
         /* prepare FatFs to talk to the volume */
@@ -240,6 +278,21 @@ disk_t *disk_get_info(int nr)
     return disk_table[nr];
 }
 
+/* have the drive write out its own write cache */
+bool disk_flush_cache(int disknr)
+{
+    disk_t *disk = disk_get_info(disknr);
+
+    if(!disk)
+        return false;
+    if(!disk->flush_cache)
+        return true;
+
+    ide_set_register(disk->ctrl, ATA_REG_DEVICE, disk->disk == 0 ? 0xE0 : 0xF0);
+    ide_set_register(disk->ctrl, ATA_REG_CMD, IDE_CMD_FLUSH_CACHE);
+    return ide_wait_status(disk->ctrl, IDE_STATUS_READY);
+}
+
 bool disk_data_read(int disknr, void *buff, uint32_t sector, int sector_count)
 {
     return disk_data_readwrite(disknr, buff, sector, sector_count, false);
@@ -23,6 +23,7 @@
 #include <cpu.h>
 #include <cli.h>
 #include <init.h>
+#include <disk.h>
 
 /* bounce buffer */
 void   * loader_scratch_space = NULL;
@@ -71,6 +72,9 @@ void execute(void *entry_vector, int argc, char **argv)
         cmdbuf[cmdoff++] = 0;
     }
 
+    /* nothing we hold back from the disk survives the jump */
+    disk_cache_sync_all();
+
     printf("Entry at 0x%lx in supervisor mode, SP 0x%lx\n", (uint32_t)entry_vector, ram_size);
     uart_flush();
     eth_halt();
@@ -120,6 +124,75 @@ static void bounce_expand(uint32_t paddr, uint32_t bounce_size)
     }
 }
 
+/* check a target range is usable and grow the bounce buffer to cover any part of it that needs bouncing */
+bool load_reserve(uint32_t paddr, uint32_t size)
+{
+    const char *load_err;
+
+    load_err = check_writable_range(paddr, size, true);
+    if(load_err){
+        printf("Abort: address range error: %s\n", load_err);
+        return false;
+    }
+
+    if(paddr < bounce_below_addr){
+        if(bounce_below_addr - paddr < size)
+            size = bounce_below_addr - paddr;
+        bounce_expand(paddr, size);
+    }
+
+    return true;
+}
+
+/* copy data from a buffer into target memory, diverting through the bounce buffer as required */
+bool load_data_buffer(uint32_t paddr, const void *data, uint32_t size)
+{
+    uint32_t bounce_size;
+    void *dest;
+
+    if(!load_reserve(paddr, size))
+        return false;
+
+    if(paddr < bounce_below_addr){
+        bounce_size = bounce_below_addr - paddr;
+        if(bounce_size > size)
+            bounce_size = size;
+        dest = (char*)loader_bounce_buffer_data + (paddr - loader_bounce_buffer_target);
+        if(data){
+            memcpy(dest, data, bounce_size);
+            data = (const char*)data + bounce_size;
+        }else
+            memset(dest, 0, bounce_size);
+        paddr += bounce_size;
+        size -= bounce_size;
+    }
+
+    if(size){
+        if(data)
+            memcpy((void*)paddr, data, size);
+        else
+            memset((void*)paddr, 0, size);
+    }
+
+    return true;
+}
+
+/* where data for a target range reserved with load_reserve() can be written
+   directly: in place, or in the bounce buffer. NULL if the range is not all
+   on one side of bounce_below_addr, or not reserved. */
+void *load_data_pointer(uint32_t paddr, uint32_t size)
+{
+    if(paddr >= bounce_below_addr)
+        return check_writable_range(paddr, size, false) ? NULL : (void*)paddr;
+
+    if(!loader_bounce_buffer_data || paddr < loader_bounce_buffer_target ||
+       paddr + size > loader_bounce_buffer_target + loader_bounce_buffer_size ||
+       paddr + size > bounce_below_addr)
+        return NULL;
+
+    return (char*)loader_bounce_buffer_data + (paddr - loader_bounce_buffer_target);
+}
+
 FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size)
 {
     unsigned int bytes_read;
@@ -267,69 +340,64 @@ bool load_m68k_executable(char *argv[], int argc, FIL *fd)
     return true; /* unlikely we will return ... */
 }
 
-bool load_elf_executable(char *argv[], int argc, FIL *fd)
-{
-    int proghead_num;
-    unsigned int bytes_read;
+typedef struct {
     elf32_header header;
-    const char *load_err;
-    void *proghead_data = NULL;
-    elf32_program_header *proghead = NULL;
-#ifdef MACH_THIS
-    struct bootversion *bootver;
-    struct bi_record *bootinfo;
-    struct mem_info *meminfo;
-#endif
-    bool failed = false;
-    uint32_t max_load_addr = 0;
-    uint32_t min_load_addr = ~0;
-    uint32_t load_offset = 0;
+    void *proghead_data;
+    uint32_t min_load_addr;
+    uint32_t max_load_addr;
+    uint32_t load_offset;
+} elf_image_t;
 
-    f_lseek(fd, 0);
-    if(f_read(fd, &header, sizeof(header), &bytes_read) != FR_OK || bytes_read != sizeof(header)){
-        printf("Cannot read ELF file header\n");
-        return false;
-    }
-
-    if(header.ident_magic[0] != 0x7F ||
-       header.ident_magic[1] != 'E' ||
-       header.ident_magic[2] != 'L' ||
-       header.ident_magic[3] != 'F' ||
-       header.ident_version != 1){
+static bool elf_check_header(elf32_header *header)
+{
+    if(header->ident_magic[0] != 0x7F ||
+       header->ident_magic[1] != 'E' ||
+       header->ident_magic[2] != 'L' ||
+       header->ident_magic[3] != 'F' ||
+       header->ident_version != 1){
         printf("Bad ELF header\n");
         return false;
     }
 
-    if(header.ident_class != 1 || /* 32-bit */
-       header.ident_data != 2 ||  /* big-endian */
-       header.ident_osabi != 0 ||
-       header.ident_abiversion != 0){
+    if(header->ident_class != 1 || /* 32-bit */
+       header->ident_data != 2 ||  /* big-endian */
+       header->ident_osabi != 0 ||
+       header->ident_abiversion != 0){
         printf("Not a 32-bit ELF file.\n");
         return false;
     }
 
-    if(header.type != 2){
+    if(header->type != 2){
         printf("ELF file is not an executable.\n");
         return false;
     }
 
-    if(header.machine != 4){
+    if(header->machine != 4){
         printf("ELF file is not for 68000 processor.\n");
         return false;
     }
 
-    proghead_data = malloc(header.phentsize * header.phnum);
-    if(f_lseek(fd, header.phoff) != FR_OK ||
-       f_read(fd, proghead_data, header.phentsize * header.phnum, NULL) != FR_OK){
-        printf("Cannot read ELF program headers.\n");
-        free(proghead_data);
-        return false;
-    }
+    return true;
+}
+
+static elf32_program_header *elf_program_header(elf_image_t *elf, int proghead_num)
+{
+    return (elf32_program_header*)(elf->proghead_data + proghead_num * elf->header.phentsize);
+}
+
+/* check for conditions we cannot load, figure out the min and max load addresses */
+static bool elf_scan_program_headers(elf_image_t *elf)
+{
+    int proghead_num;
+    const char *load_err;
+    elf32_program_header *proghead;
+
+    elf->min_load_addr = ~0;
+    elf->max_load_addr = 0;
+    elf->load_offset = 0;
 
-    // initial scan over headers: check for conditions we cannot load,
-    // figure out the min and max load addresses
-    for(proghead_num=0; !failed && proghead_num < header.phnum; proghead_num++){
-        proghead = (elf32_program_header*)(proghead_data + proghead_num * header.phentsize);
+    for(proghead_num=0; proghead_num < elf->header.phnum; proghead_num++){
+        proghead = elf_program_header(elf, proghead_num);
         switch(proghead->type){
             case PT_NULL:
             case PT_NOTE:
@@ -338,58 +406,81 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
             case PT_SHLIB: /* "reserved but has unspecified semantics" */
             case PT_DYNAMIC:
                 printf("ELF executable is dynamically linked.\n");
-                failed = true;
-                break;
+                return false;
             case PT_INTERP:
                 printf("ELF executable requires an interpreter.\n");
-                failed = true;
-                break;
+                return false;
             case PT_LOAD:
                 // min/max addr calc
-                if(proghead->paddr < min_load_addr)
-                    min_load_addr = proghead->paddr;
-                if(proghead->paddr + proghead->memsz > max_load_addr)
-                    max_load_addr = proghead->paddr + proghead->memsz;
+                if(proghead->paddr < elf->min_load_addr)
+                    elf->min_load_addr = proghead->paddr;
+                if(proghead->paddr + proghead->memsz > elf->max_load_addr)
+                    elf->max_load_addr = proghead->paddr + proghead->memsz;
                 break;
         }
     }
 
-    if(failed){
-        free(proghead_data);
-        return false;
-    }
-
-    printf("Load address range 0x%lx -- 0x%lx\n", min_load_addr, max_load_addr);
+    printf("Load address range 0x%lx -- 0x%lx\n", elf->min_load_addr, elf->max_load_addr);
 
-    if(min_load_addr < rom_below_addr){
+    if(elf->min_load_addr < rom_below_addr){
         /* uh-oh, it will overlap with ROM */
         printf("Load would overlap ROM, offsetting by 0x%x\n", EXECUTABLE_LOAD_ADDRESS);
         /* BUT WE CAN FIX IT -- for linux at least -- by loading at a fixed offset!
            how to detect when we can safely do this ... could just do it and then check 
            for the magic value to confirm was safe before proceeding? */
-        load_offset = EXECUTABLE_LOAD_ADDRESS;
-        min_load_addr += EXECUTABLE_LOAD_ADDRESS;
-        max_load_addr += EXECUTABLE_LOAD_ADDRESS;
-        printf("Load address range 0x%lx -- 0x%lx\n", min_load_addr, max_load_addr);
+        elf->load_offset = EXECUTABLE_LOAD_ADDRESS;
+        elf->min_load_addr += EXECUTABLE_LOAD_ADDRESS;
+        elf->max_load_addr += EXECUTABLE_LOAD_ADDRESS;
+        printf("Load address range 0x%lx -- 0x%lx\n", elf->min_load_addr, elf->max_load_addr);
     }
 
-    load_err = check_writable_range(min_load_addr, max_load_addr - min_load_addr, true);
+    load_err = check_writable_range(elf->min_load_addr, elf->max_load_addr - elf->min_load_addr, true);
     if(load_err){
         printf("Abort: address range error: %s\n", load_err);
-        failed = true;
+        return false;
     }
 
-    if(failed){
-        free(proghead_data);
+    return true;
+}
+
+static bool elf_execute(elf_image_t *elf, char *argv[], int argc, uint32_t tftp_server_ip);
+
+bool load_elf_executable(char *argv[], int argc, FIL *fd)
+{
+    int proghead_num;
+    unsigned int bytes_read;
+    elf_image_t elf;
+    elf32_program_header *proghead;
+    bool failed = false;
+
+    f_lseek(fd, 0);
+    if(f_read(fd, &elf.header, sizeof(elf.header), &bytes_read) != FR_OK || bytes_read != sizeof(elf.header)){
+        printf("Cannot read ELF file header\n");
+        return false;
+    }
+
+    if(!elf_check_header(&elf.header))
+        return false;
+
+    elf.proghead_data = malloc(elf.header.phentsize * elf.header.phnum);
+    if(f_lseek(fd, elf.header.phoff) != FR_OK ||
+       f_read(fd, elf.proghead_data, elf.header.phentsize * elf.header.phnum, NULL) != FR_OK){
+        printf("Cannot read ELF program headers.\n");
+        free(elf.proghead_data);
+        return false;
+    }
+
+    if(!elf_scan_program_headers(&elf)){
+        free(elf.proghead_data);
         return false;
     }
 
     // second pass: do the actual loading
-    for(proghead_num=0; !failed && proghead_num < header.phnum; proghead_num++){
-        proghead = (elf32_program_header*)(proghead_data + proghead_num * header.phentsize);
+    for(proghead_num=0; !failed && proghead_num < elf.header.phnum; proghead_num++){
+        proghead = elf_program_header(&elf, proghead_num);
         switch(proghead->type){
             case PT_LOAD:
-                if(load_data(fd, load_offset + proghead->paddr, proghead->offset, proghead->filesz, proghead->memsz) != FR_OK){
+                if(load_data(fd, elf.load_offset + proghead->paddr, proghead->offset, proghead->filesz, proghead->memsz) != FR_OK){
                     printf("Unable to load segment from ELF file.\n");
                     failed = true;
                 }                
@@ -399,11 +490,246 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         }
     }
 
-    free(proghead_data);
-    proghead_data = NULL;
+    free(elf.proghead_data);
+    if(failed)
+        return false;
+
+    return elf_execute(&elf, argv, argc, 0);
+}
+
+/*
+ * Streaming ELF loader, fed with file data in order as it arrives over the
+ * network. Everything up to the end of the program headers is buffered, then
+ * each block is scattered into the PT_LOAD segments it overlaps. The headers
+ * must therefore be near the start of the file, which is always the case for
+ * the kernels we boot.
+ */
+
+#define ELF_STREAM_HEAD_MAX 4096
+
+typedef struct {
+    elf_image_t elf;
+    uint8_t *head;          /* file data buffered until the program headers are complete */
+    uint32_t head_length;
+    uint32_t received;      /* bytes of file data seen so far */
+    bool headers_done;
+} elf_stream_t;
+
+static bool elf_stream_scatter(elf_stream_t *stream, uint32_t offset, const uint8_t *data, uint32_t length)
+{
+    uint32_t start, end;
+    elf32_program_header *proghead;
+
+    for(int proghead_num=0; proghead_num < stream->elf.header.phnum; proghead_num++){
+        proghead = elf_program_header(&stream->elf, proghead_num);
+        if(proghead->type != PT_LOAD)
+            continue;
+        start = offset > proghead->offset ? offset : proghead->offset;
+        end = offset + length;
+        if(end > proghead->offset + proghead->filesz)
+            end = proghead->offset + proghead->filesz;
+        if(start < end && !load_data_buffer(stream->elf.load_offset + proghead->paddr + (start - proghead->offset),
+                                             data + (start - offset), end - start))
+            return false;
+    }
+
+    return true;
+}
+
+static bool elf_stream_prepare(elf_stream_t *stream)
+{
+    elf32_program_header *proghead;
+
+    if(!elf_scan_program_headers(&stream->elf))
+        return false;
+
+    /* reserve each segment now, so the bounce buffer is sized once, and zero the part not present in the file */
+    for(int proghead_num=0; proghead_num < stream->elf.header.phnum; proghead_num++){
+        proghead = elf_program_header(&stream->elf, proghead_num);
+        if(proghead->type != PT_LOAD)
+            continue;
+        printf("Streaming 0x%lx bytes", proghead->filesz);
+        if(proghead->memsz > proghead->filesz)
+            printf(" + 0x%lx padding", proghead->memsz - proghead->filesz);
+        printf(" from file offset 0x%lx to memory at 0x%lx\n",
+                proghead->offset, stream->elf.load_offset + proghead->paddr);
+        if(!load_reserve(stream->elf.load_offset + proghead->paddr, proghead->memsz))
+            return false;
+        if(proghead->memsz > proghead->filesz &&
+           !load_data_buffer(stream->elf.load_offset + proghead->paddr + proghead->filesz,
+                             NULL, proghead->memsz - proghead->filesz))
+            return false;
+    }
+
+    return true;
+}
+
+static bool elf_stream_data(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size)
+{
+    elf_stream_t *stream = cb_private;
+    uint32_t headers_end;
+
+    stream->received = offset + length;
+
+    if(stream->headers_done)
+        return elf_stream_scatter(stream, offset, data, length);
+
+    if(offset + length > ELF_STREAM_HEAD_MAX){
+        printf("ELF program headers not found at start of file.\n");
+        return false;
+    }
+
+    memcpy(stream->head + offset, data, length);
+    stream->head_length = offset + length;
+
+    if(stream->head_length < sizeof(elf32_header))
+        return true;
+
+    memcpy(&stream->elf.header, stream->head, sizeof(elf32_header));
+    if(!elf_check_header(&stream->elf.header))
+        return false;
+
+    headers_end = stream->elf.header.phoff + stream->elf.header.phentsize * stream->elf.header.phnum;
+    if(headers_end > ELF_STREAM_HEAD_MAX){
+        printf("ELF program headers not found at start of file.\n");
+        return false;
+    }
+
+    if(stream->head_length < headers_end)
+        return true;
+
+    stream->elf.proghead_data = stream->head + stream->elf.header.phoff;
+    if(!elf_stream_prepare(stream))
+        return false;
+    stream->headers_done = true;
+
+    /* now we know where it goes, load the data we held back */
+    return elf_stream_scatter(stream, 0, stream->head, stream->head_length);
+}
+
+/* check that the transfer delivered every loadable segment */
+static bool elf_stream_complete(elf_stream_t *stream)
+{
+    elf32_program_header *proghead;
+
+    if(!stream->headers_done){
+        printf("ELF file truncated.\n");
+        return false;
+    }
+
+    for(int proghead_num=0; proghead_num < stream->elf.header.phnum; proghead_num++){
+        proghead = elf_program_header(&stream->elf, proghead_num);
+        if(proghead->type == PT_LOAD && proghead->offset + proghead->filesz > stream->received){
+            printf("ELF file truncated.\n");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool load_elf_executable_tftp(char *argv[], int argc, uint32_t tftp_server_ip, const char *tftp_filename)
+{
+    elf_stream_t stream;
+    bool failed = false;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.head = malloc(ELF_STREAM_HEAD_MAX);
+
+    if(!tftp_receive(tftp_server_ip, tftp_filename, elf_stream_data, &stream) ||
+       !elf_stream_complete(&stream))
+        failed = true;
+
+    free(stream.head);
     if(failed)
         return false;
 
+    return elf_execute(&stream.elf, argv, argc, tftp_server_ip);
+}
+
+/*
+ * Network boot from the file named by DHCP. It is either an ELF kernel,
+ * which is streamed into place and run, or a script, which is held in
+ * memory and run line by line. We find out which from the first block.
+ */
+
+#define NETBOOT_SCRIPT_MAX 8192
+
+typedef struct {
+    elf_stream_t elf;
+    bool is_elf;
+    bool is_script;
+    char *script;
+    uint32_t script_length;
+} netboot_stream_t;
+
+static bool netboot_data(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size)
+{
+    netboot_stream_t *boot = cb_private;
+
+    if(offset == 0){
+        if(length >= 4 && memcmp(data, "\177ELF", 4) == 0){
+            boot->is_elf = true;
+        }else if(length >= 8 && strncasecmp(data, "#!script", 8) == 0){
+            boot->is_script = true;
+            boot->script = malloc(NETBOOT_SCRIPT_MAX);
+        }else{
+            printf("Boot file is not an ELF executable or a script.\n");
+            return false;
+        }
+    }
+
+    if(boot->is_elf)
+        return elf_stream_data(&boot->elf, offset, data, length, total_size);
+
+    if(offset + length > NETBOOT_SCRIPT_MAX){
+        printf("Boot script too large.\n");
+        return false;
+    }
+    memcpy(boot->script + offset, data, length);
+    boot->script_length = offset + length;
+    return true;
+}
+
+bool load_netboot_tftp(uint32_t tftp_server_ip, const char *tftp_filename)
+{
+    netboot_stream_t boot;
+    char *argv[2];
+    bool ok;
+
+    memset(&boot, 0, sizeof(boot));
+    boot.elf.head = malloc(ELF_STREAM_HEAD_MAX);
+
+    ok = tftp_receive(tftp_server_ip, tftp_filename, netboot_data, &boot);
+    if(ok && boot.is_elf)
+        ok = elf_stream_complete(&boot.elf);
+    free(boot.elf.head);
+
+    if(ok && boot.is_elf){
+        argv[0] = (char*)tftp_filename;
+        argv[1] = NULL;
+        ok = elf_execute(&boot.elf.elf, argv, 1, tftp_server_ip);
+    }else if(ok && boot.is_script){
+        execute_script_buffer(tftp_filename, boot.script, boot.script_length);
+    }
+
+    free(boot.script);
+    return ok;
+}
+
+/* run a loaded ELF image, constructing Linux bootinfo if required. initrd is fetched from the
+ * TFTP server when tftp_server_ip is non-zero, otherwise from disk */
+static bool elf_execute(elf_image_t *elf, char *argv[], int argc, uint32_t tftp_server_ip)
+{
+#ifdef MACH_THIS
+    unsigned int bytes_read;
+    struct bootversion *bootver;
+    struct bi_record *bootinfo;
+    struct mem_info *meminfo;
+    uint32_t min_load_addr = elf->min_load_addr;
+    uint32_t max_load_addr = elf->max_load_addr;
+#endif
+
 #ifdef MACH_THIS
     /* check for linux kernel magic number at lowest load address */
     if(min_load_addr < bounce_below_addr)
@@ -522,7 +848,19 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
 
         /* check for initrd */
         FIL initrd;
-        if(initrd_name && (f_open(&initrd, initrd_name, FA_READ) == FR_OK)){
+        if(initrd_name && tftp_server_ip){
+            bootinfo->tag = BI_RAMDISK;
+            bootinfo->size = sizeof(struct bi_record) + sizeof(struct mem_info);
+            meminfo = (struct mem_info*)bootinfo->data;
+            /* we need to locate the initrd some distance above the kernel -- 1MB should be enough? */
+            meminfo->addr = ((((unsigned long)bootinfo) + 0xfff) & ~0xfff) + 0x100000;
+            printf("Loading initrd \"%s\" at 0x%lx\n", initrd_name, meminfo->addr);
+            if(!tftp_load(tftp_server_ip, initrd_name, meminfo->addr, &meminfo->size)){
+                printf("Unable to load initrd.\n");
+                return false;
+            }
+            bootinfo = (struct bi_record*)(((char*)bootinfo) + bootinfo->size);
+        }else if(initrd_name && (f_open(&initrd, initrd_name, FA_READ) == FR_OK)){
             bootinfo->tag = BI_RAMDISK;
             bootinfo->size = sizeof(struct bi_record) + sizeof(struct mem_info);
             meminfo = (struct mem_info*)bootinfo->data;
@@ -558,14 +896,12 @@ bool load_elf_executable(char *argv[], int argc, FIL *fd)
         /* could bail here if load offset was applied */
     }
 #endif
-    if(!failed){
-        /* remove program name from command line */
-        if(argc > 0){
-            argc--;
-            argv++;
-        }
-        execute((void*)(header.entry + load_offset), argc, argv);
+    /* remove program name from command line */
+    if(argc > 0){
+        argc--;
+        argv++;
     }
+    execute((void*)(elf->header.entry + elf->load_offset), argc, argv);
 
     return true;
 }
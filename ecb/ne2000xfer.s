@@ -0,0 +1,134 @@
+        .globl  ne2000_pio_input
+        .globl  ne2000_pio_input_sum
+        .globl  ne2000_pio_output
+
+        .text
+        .even
+
+/* NE2000 remote DMA data port transfers for the 8-bit ECB bus on KISS-68030
+   and Mini68K.
+
+   Every byte has to cross the bus on its own, so the loops use memory to
+   memory byte moves, which need no register at all, unrolled 16 times to
+   take the loop overhead out of the way. Only 68000 instructions are used
+   so the same code serves both boards. */
+
+/* void ne2000_pio_input(void *buf, volatile uint8_t *port, unsigned int len) */
+ne2000_pio_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    move.l %d0,%d1              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_in_blockloop
+
+pio_in_block:
+    .rept 16
+    move.b %a1@,%a0@+
+    .endr
+pio_in_blockloop:
+    dbra %d0, pio_in_block
+
+    andi.w #15,%d1              /* remaining bytes */
+    bra.s pio_in_byteloop
+pio_in_byte:
+    move.b %a1@,%a0@+
+pio_in_byteloop:
+    dbra %d1, pio_in_byte
+    rts
+
+/* uint32_t ne2000_pio_input_sum(void *buf, volatile uint8_t *port, unsigned int len)
+
+   As ne2000_pio_input, but also returns the one's complement sum of the data
+   (padded with a zero byte if len is odd), folded to at most 17 bits. Each
+   16 byte block is summed as longwords straight after it is copied. buf
+   must be even. */
+ne2000_pio_input_sum:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    /* save registers */
+    movem.l %d2-%d5,-(%sp)
+
+    moveq #0,%d2                /* running sum */
+    moveq #0,%d4                /* constant zero, to fold in the carry */
+    move.l %d0,%d5              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_ins_blockloop
+
+pio_ins_block:
+    .rept 16
+    move.b %a1@,%a0@+
+    .endr
+    add.l %a0@(-16),%d2
+    move.l %a0@(-12),%d3
+    addx.l %d3,%d2
+    move.l %a0@(-8),%d3
+    addx.l %d3,%d2
+    move.l %a0@(-4),%d3
+    addx.l %d3,%d2
+    addx.l %d4,%d2              /* end around carry */
+pio_ins_blockloop:
+    dbra %d0, pio_ins_block
+
+    move.w %d5,%d0
+    andi.w #15,%d0
+    lsr.w #1,%d0                /* remaining whole words */
+    moveq #0,%d1
+    bra.s pio_ins_wordloop
+pio_ins_word:
+    move.b %a1@,%d1             /* first byte is the high half */
+    lsl.w #8,%d1
+    move.b %a1@,%d1
+    move.w %d1,%a0@+
+    add.l %d1,%d2
+    addx.l %d4,%d2
+pio_ins_wordloop:
+    dbra %d0, pio_ins_word
+
+    btst #0,%d5                 /* odd length? */
+    beq.s pio_ins_fold
+    moveq #0,%d1
+    move.b %a1@,%d1
+    move.b %d1,%a0@
+    lsl.w #8,%d1                /* pad with zero */
+    add.l %d1,%d2
+    addx.l %d4,%d2
+
+pio_ins_fold:
+    move.l %d2,%d0
+    clr.w %d2
+    swap %d2                    /* high word */
+    andi.l #0xffff,%d0          /* low word */
+    add.l %d2,%d0               /* at most 0x1fffe */
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d5
+    rts
+
+/* void ne2000_pio_output(const void *buf, volatile uint8_t *port, unsigned int len) */
+ne2000_pio_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    move.l %d0,%d1              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_out_blockloop
+
+pio_out_block:
+    .rept 16
+    move.b %a0@+,%a1@
+    .endr
+pio_out_blockloop:
+    dbra %d0, pio_out_block
+
+    andi.w #15,%d1              /* remaining bytes */
+    bra.s pio_out_byteloop
+pio_out_byte:
+    move.b %a0@+,%a1@
+pio_out_byteloop:
+    dbra %d1, pio_out_byte
+    rts
@@ -63,18 +63,28 @@ void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val)
     }
 }
 
-void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
+void ide_transfer_block_read(disk_controller_t *ctrl, void *ptr, int nsectors)
 {
     ide_set_data_direction(ctrl, true);
     *ctrl->select = PPIDE_REG_DATA;
-    ide_sector_xfer_input(ptr, ctrl->lsb);
+    ide_block_xfer_input(ptr, ctrl->lsb, nsectors);
 }
 
-void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+void ide_transfer_block_write(disk_controller_t *ctrl, const void *ptr, int nsectors)
 {
     ide_set_data_direction(ctrl, false);
     *ctrl->select = PPIDE_REG_DATA;
-    ide_sector_xfer_output(ptr, ctrl->lsb);
+    ide_block_xfer_output(ptr, ctrl->lsb, nsectors);
+}
+
+void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
+{
+    ide_transfer_block_read(ctrl, ptr, 1);
+}
+
+void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+{
+    ide_transfer_block_write(ctrl, ptr, 1);
 }
 
 static void ide_controller_init(disk_controller_t *ctrl, uint16_t base_io)
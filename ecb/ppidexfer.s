@@ -1,22 +1,31 @@
-        .globl  ide_sector_xfer_input
-        .globl  ide_sector_xfer_output
+        .globl  ide_block_xfer_input
+        .globl  ide_block_xfer_output
 
         .text
         .even
 
-ide_sector_xfer_input:
+/* PPIDE data register transfers through the 8255, a whole multi-sector
+   block per call. The loops move 16 bytes per iteration (four DWORDs, each
+   two /RD or /WR pulses on the 16-bit IDE bus) so the loop overhead and the
+   register setup are paid once per block rather than once per sector. */
+
+/* void ide_block_xfer_input(void *buf, volatile uint8_t *port, int nsectors) */
+ide_block_xfer_input:
     moveal %sp@(4),%a0          /* void *buf */
     moveal %sp@(8),%a1          /* 8255 base address */
+    movel %sp@(12),%d1          /* sectors */
 
     /* save registers */
     movem.l %d2-%d3/%a2,-(%sp)
-    
+
     lea %a1@(3),%a2             /* 8255 control register */
     moveq #13, %d2
     moveq #12, %d3
-    moveq #127, %d1             /* total 128x4=512 bytes */
+    lsl.l #5, %d1               /* 32x16=512 bytes per sector */
+    bra.s ide_input_loop
 
-ide_input_nextword:
+ide_input_nextblock:
+    .rept 4
     /* read a DWORD */
     moveb %d2, %a2@             /* begin /RD pulse */
     movew %a1@, %d0             /* reads LSB then MSB in that order */
@@ -28,35 +37,40 @@ ide_input_nextword:
 
     /* store to memory */
     movel %d0, %a0@+
+    .endr
 
     /* loop until done */
 ide_input_loop:
-    dbra %d1, ide_input_nextword
+    dbra %d1, ide_input_nextblock
 
     /* restore registers, return */
     movem.l (%sp)+,%d2-%d3/%a2
     rts
 
 
-ide_sector_xfer_output:
+/* void ide_block_xfer_output(const void *buf, volatile uint8_t *port, int nsectors) */
+ide_block_xfer_output:
     moveal %sp@(4),%a0          /* void *buf */
     moveal %sp@(8),%a1          /* 8255 base address */
+    movel %sp@(12),%d1          /* sectors */
 
     /* save registers */
     movem.l %d2-%d3/%a2,-(%sp)
-    
+
     lea %a1@(3),%a2             /* 8255 control register */
     moveq #11, %d2
     moveq #10, %d3
-    moveq #127, %d1             /* total (127+1)*4=512 bytes */
+    lsl.l #5, %d1               /* 32x16=512 bytes per sector */
+    bra.s ide_output_loop
 
     /* note that to give the drive time to latch the data we do
        housekeeping including swaps and branches while the /WR
-       line is asserted -- so the first thing we do each loop is
-       end the previous cycle's /WR pulse, which is a NOP on the
+       line is asserted -- so the first thing we do each DWORD is
+       end the previous DWORD's /WR pulse, which is a NOP on the
        entry to the first loop */
 
-ide_output_nextword:
+ide_output_nextblock:
+    .rept 4
     /* load from memory */
     movel %a0@+, %d0
     /* write a DWORD */
@@ -68,8 +82,10 @@ ide_output_nextword:
     moveb %d3, %a2@             /* end /WR pulse */
     movew %d0, %a1@             /* set up data lines */
     moveb %d2, %a2@             /* begin /WR pulse */
+    .endr
     /* loop until done */
-    dbra %d1, ide_output_nextword
+ide_output_loop:
+    dbra %d1, ide_output_nextblock
 
     moveb %d3, %a2@          /* end the final /WR pulse */
 
@@ -42,7 +42,7 @@ DRESULT disk_read(BYTE pdrv, BYTE *buff, LBA_t sector, UINT count)
     if(disk_disk->fat_fs_status & (STA_NOINIT | STA_NODISK))
         return RES_NOTRDY;
 
-    if(disk_data_read(pdrv, buff, sector, count))
+    if(disk_cache_read(pdrv, buff, sector, count))
         return RES_OK;
     else
         return RES_ERROR;
@@ -61,7 +61,7 @@ DRESULT disk_write(BYTE pdrv, const BYTE *buff, LBA_t sector, UINT count)
     if(disk_disk->fat_fs_status & STA_PROTECT)
         return RES_WRPRT;
 
-    if(disk_data_write(pdrv, buff, sector, count))
+    if(disk_cache_write(pdrv, buff, sector, count))
         return RES_OK;
     else
         return RES_ERROR;
@@ -79,6 +79,7 @@ DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
 
     switch(cmd){
         case CTRL_SYNC:
+            return disk_cache_sync(pdrv) ? RES_OK : RES_ERROR;
         case CTRL_TRIM:
             return RES_OK;
         case GET_SECTOR_SIZE:
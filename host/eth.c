@@ -0,0 +1,193 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <net.h>
+#include "host.h"
+
+// The eth_* interface that net/ne2000.c provides on the boards, over either
+// a TAP interface or a pcap file replayed as received traffic.
+//
+// A TAP frame is read whole into a bounce buffer and then copied to where
+// the NE2000 driver would have put it, summing it on the way as the driver
+// does, so the stack runs the same paths as on a board: received in place
+// when net_rx_direct_target() offers a target, checksums from rx_sum.
+//
+// Replay (see replay.c) hands the stack frames from a capture, and throws
+// away what the stack transmits after telling the replay about it.
+
+// report a receive ring the size of a Q40's NE2000 with three transmit
+// slots, so window sizes come out the same as on the board
+#define HOST_RX_PAGES 46
+
+#define HOST_RX_BATCH 16        // frames to take per eth_pump()
+#define HOST_POLL_MS   1        // wait for traffic when there is nothing to do
+
+static host_eth_mode_t eth_mode;
+static int eth_fd = -1;
+static bool eth_open;
+static uint8_t eth_frame[PACKET_MAXLEN];
+
+static uint32_t eth_rx_frames, eth_tx_frames, eth_tx_errors;
+static uint32_t eth_poll_waits;
+
+bool host_eth_open(host_eth_mode_t mode, const char *name)
+{
+    eth_mode = mode;
+    switch(mode){
+        case host_eth_tap:
+            eth_fd = tap_open(name);
+            if(eth_fd < 0)
+                return false;
+            break;
+        case host_eth_replay:
+            if(!replay_open(name))
+                return false;
+            break;
+    }
+
+    eth_open = true;
+    return true;
+}
+
+bool eth_init(void)
+{
+    if(!eth_open){
+        printf("No host network interface\n");
+        return false;
+    }
+
+    printf("%s, MAC %02x:%02x:%02x:%02x:%02x:%02x, %dKB rx\n",
+            eth_mode == host_eth_tap ? "TAP interface" : "pcap replay",
+            interface_macaddr[0], interface_macaddr[1], interface_macaddr[2],
+            interface_macaddr[3], interface_macaddr[4], interface_macaddr[5],
+            HOST_RX_PAGES >> 2);
+    return true;
+}
+
+void eth_halt(void)
+{
+    if(eth_fd >= 0)
+        host_close(eth_fd);
+    eth_fd = -1;
+    eth_open = false;
+}
+
+// returns the length of the frame now in eth_frame[], or 0 if there is none
+static int eth_read_frame(void)
+{
+    int length;
+
+    if(eth_mode == host_eth_tap){
+        length = host_read(eth_fd, eth_frame, sizeof(eth_frame));
+        return length < 0 ? 0 : length;
+    }
+
+    return replay_next_frame(eth_frame, sizeof(eth_frame));
+}
+
+static void eth_push_frame(int length)
+{
+    packet_t *packet;
+    uint8_t *target;
+    int header_len;
+
+    packet = packet_alloc(length);
+    header_len = net_rx_direct_header_length();
+    if(header_len && header_len < length){
+        memcpy(packet->buffer, eth_frame, header_len);
+        packet->rx_sum = net_checksum_update(0, packet->buffer, header_len);
+        target = net_rx_direct_target(packet);
+        if(target){
+            memcpy(target, eth_frame + header_len, packet->rx_direct_length);
+            packet->rx_sum = net_checksum_update(packet->rx_sum, target, packet->rx_direct_length);
+        }else{
+            memcpy(packet->buffer + header_len, eth_frame + header_len, length - header_len);
+            packet->rx_sum = net_checksum_update(packet->rx_sum, packet->buffer + header_len, length - header_len);
+        }
+    }else{
+        memcpy(packet->buffer, eth_frame, length);
+        packet->rx_sum = net_checksum_update(0, packet->buffer, length);
+    }
+    packet->flags |= packet_flag_rx_sum_valid;
+    eth_rx_frames++;
+    net_eth_push(packet);
+}
+
+bool eth_attempt_tx(packet_t *packet)
+{
+    eth_tx_frames++;
+    if(eth_mode == host_eth_replay)
+        replay_transmitted(packet->buffer, packet->buffer_length);
+    else if(host_write(eth_fd, packet->buffer, packet->buffer_length) != packet->buffer_length)
+        eth_tx_errors++;
+    return true;
+}
+
+void eth_pump(void)
+{
+    struct host_pollfd pfd;
+    packet_t *packet;
+    int length, frames;
+
+    if(!eth_open)
+        return;
+
+    for(frames=0; frames<HOST_RX_BATCH; frames++){
+        length = eth_read_frame();
+        if(!length)
+            break;
+        eth_push_frame(length);
+    }
+
+    while((packet = net_eth_pull())){
+        eth_attempt_tx(packet);
+        packet_free(packet);
+    }
+
+    // block briefly rather than spin when the interface is idle, so that the
+    // CPU time we use is that spent on the traffic
+    if(!frames){
+        eth_poll_waits++;
+        pfd.fd = eth_fd;
+        pfd.events = POLLIN;
+        host_poll(&pfd, eth_fd >= 0 ? 1 : 0, HOST_POLL_MS);
+    }
+}
+
+int eth_rxbuffer_size(void)
+{
+    return eth_open ? HOST_RX_PAGES << 8 : 0;
+}
+
+// the kernel queues frames for us, so this never fills up
+int eth_rxbuffer_free(void)
+{
+    return eth_open ? (HOST_RX_PAGES - 1) << 8 : 0;
+}
+
+// a TAP interface hears every frame on the bridge anyway; net_eth_push() filters them
+void eth_set_multicast_list(const macaddr_t *list, int count)
+{
+}
+
+void eth_rx_benchmark(void)
+{
+    printf("eth: no receive benchmark on the host\n");
+}
+
+void eth_dump_stats(void)
+{
+    if(!eth_open)
+        return;
+    printf("eth_rx_frames %ld\n", eth_rx_frames);
+    printf("eth_tx_frames %ld (%ld failed)\n", eth_tx_frames, eth_tx_errors);
+    printf("eth_poll_waits %ld\n", eth_poll_waits);
+}
+
+void eth_reset_stats(void)
+{
+    eth_rx_frames = eth_tx_frames = eth_tx_errors = 0;
+    eth_poll_waits = 0;
+}
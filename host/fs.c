@@ -0,0 +1,102 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <fatfs/ff.h>
+#include <cli.h>
+#include "host.h"
+
+// Just enough of the FatFs API for net/ to read and write host files.
+// The host file descriptor lives in obj.sclust, and every file claims to be
+// on a volume with 4KB clusters so the write buffers come out the size they
+// would on a typical CF card.
+
+static FATFS host_volume = { .csize = 8 };
+
+static const char *host_errmsg[] = {
+    /* 0  */ "Succeeded",
+    /* 1  */ "A hard error occurred in the low level disk I/O layer",
+    /* 2  */ "Assertion failed",
+    /* 3  */ "The physical drive cannot work",
+    /* 4  */ "Could not find the file",
+};
+
+const char *f_errmsg(int errno)
+{
+    if(errno >= 0 && errno < sizeof(host_errmsg) / sizeof(host_errmsg[0]))
+        return host_errmsg[errno];
+    return "???";
+}
+
+FRESULT f_open(FIL *fp, const TCHAR *path, BYTE mode)
+{
+    int flags, fd;
+    long size;
+
+    if(mode & FA_WRITE){
+        flags = (mode & FA_READ) ? O_RDWR : O_WRONLY;
+        if(mode & FA_CREATE_ALWAYS)
+            flags |= O_CREAT | O_TRUNC;
+        else if(mode & (FA_OPEN_ALWAYS | FA_CREATE_NEW))
+            flags |= O_CREAT;
+    }else
+        flags = O_RDONLY;
+
+    fd = host_open(path, flags, 0644);
+    if(fd < 0)
+        return FR_NO_FILE;
+
+    size = (mode & FA_CREATE_ALWAYS) ? 0 : host_lseek(fd, 0, SEEK_END);
+    if(size < 0)
+        size = 0;
+    memset(fp, 0, sizeof(FIL));
+    fp->obj.fs = &host_volume;
+    fp->obj.sclust = fd;
+    fp->obj.objsize = size;
+    fp->fptr = ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND) ? size : 0;
+    host_lseek(fd, fp->fptr, SEEK_SET);
+    return FR_OK;
+}
+
+FRESULT f_close(FIL *fp)
+{
+    if(!fp->obj.fs)
+        return FR_INVALID_OBJECT;
+    host_close(fp->obj.sclust);
+    fp->obj.fs = NULL;
+    return FR_OK;
+}
+
+FRESULT f_read(FIL *fp, void *buff, UINT btr, UINT *br)
+{
+    int r = host_read(fp->obj.sclust, buff, btr);
+
+    *br = 0;
+    if(r < 0)
+        return FR_DISK_ERR;
+    *br = r;
+    fp->fptr += r;
+    return FR_OK;
+}
+
+FRESULT f_write(FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+    int r = host_write(fp->obj.sclust, buff, btw);
+
+    *bw = 0;
+    if(r < 0)
+        return FR_DISK_ERR;
+    *bw = r;
+    fp->fptr += r;
+    if(fp->fptr > fp->obj.objsize)
+        fp->obj.objsize = fp->fptr;
+    return FR_OK;
+}
+
+FRESULT f_lseek(FIL *fp, FSIZE_t ofs)
+{
+    if(host_lseek(fp->obj.sclust, ofs, SEEK_SET) < 0)
+        return FR_DISK_ERR;
+    fp->fptr = ofs;
+    return FR_OK;
+}
@@ -0,0 +1,80 @@
+#ifndef __HOST_DOT_H__
+#define __HOST_DOT_H__
+
+/* Linux host build: the network stack runs as an ordinary 32-bit process.
+ * We build against our own lib/ rather than the host C library, so this is
+ * the whole of our interface to the kernel: raw i386 system calls. */
+
+#include <types.h>
+
+/* i386 system call numbers */
+#define SYS_exit_group          252
+#define SYS_read                3
+#define SYS_write               4
+#define SYS_open                5
+#define SYS_close               6
+#define SYS_lseek               19
+#define SYS_ioctl               54
+#define SYS_mmap2               192
+#define SYS_poll                168
+#define SYS_clock_gettime       265
+
+#define O_RDONLY                0x0000
+#define O_WRONLY                0x0001
+#define O_RDWR                  0x0002
+#define O_CREAT                 0x0040
+#define O_TRUNC                 0x0200
+#define O_APPEND                0x0400
+#define O_NONBLOCK              0x0800
+
+#define SEEK_SET                0
+#define SEEK_CUR                1
+#define SEEK_END                2
+
+#define POLLIN                  0x0001
+
+#define CLOCK_MONOTONIC         1
+#define CLOCK_PROCESS_CPUTIME_ID 2
+
+struct host_timespec {
+    long tv_sec;
+    long tv_nsec;
+};
+
+struct host_pollfd {
+    int fd;
+    short events;
+    short revents;
+};
+
+long host_syscall(long number, long a, long b, long c);
+void host_exit(int status) __attribute__((noreturn));
+int host_read(int fd, void *buffer, int length);
+int host_write(int fd, const void *buffer, int length);
+int host_open(const char *path, int flags, int mode);
+int host_close(int fd);
+long host_lseek(int fd, long offset, int whence);
+int host_ioctl(int fd, unsigned long request, void *arg);
+int host_poll(struct host_pollfd *fds, int count, int timeout_ms);
+void host_clock_gettime(int clock, struct host_timespec *ts);
+void *host_mmap(uint32_t size); /* anonymous, zeroed; NULL on failure */
+
+/* hw.c */
+void host_init(uint32_t heap_bytes, uint32_t load_bytes);
+void host_uart_flush(void);
+extern uint8_t *host_load_area;
+extern uint32_t host_load_size;
+
+/* eth.c: the backends behind the eth_* interface */
+typedef enum { host_eth_tap, host_eth_replay } host_eth_mode_t;
+bool host_eth_open(host_eth_mode_t mode, const char *name);
+
+/* tap.c */
+int tap_open(const char *name); /* returns fd or -1 */
+
+/* replay.c */
+bool replay_open(const char *filename);
+int replay_next_frame(uint8_t *buffer, int size); /* 0 if there is none yet */
+void replay_transmitted(const uint8_t *frame, int length);
+
+#endif
@@ -0,0 +1,124 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <uart.h>
+#include <timers.h>
+#include <init.h>
+#include <cli.h>
+#include <net.h>
+#include <tinyalloc.h>
+#include "host.h"
+
+// What the boards provide to the network stack: timer, console, heap and
+// the loader's view of target memory, here in terms of a Linux process.
+
+uint32_t heap_base, heap_size;
+uint8_t *host_load_area;        // stands in for target RAM; load addresses are offsets into it
+uint32_t host_load_size;
+
+static char uart_buffer[1024];
+static int uart_buffer_used;
+
+void host_init(uint32_t heap_bytes, uint32_t load_bytes)
+{
+    heap_base = (uint32_t)host_mmap(heap_bytes);
+    host_load_area = host_mmap(load_bytes);
+    if(!heap_base || !host_load_area){
+        printf("host: cannot map %ld + %ld bytes\n", heap_bytes, load_bytes);
+        halt();
+    }
+    heap_size = heap_bytes;
+    host_load_size = load_bytes;
+    ta_init((void*)heap_base, (void*)heap_base + heap_size - 1, 2048, 16, 4);
+}
+
+timer_t gogoboot_read_timer(void)
+{
+    struct host_timespec ts;
+
+    host_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * TIMER_HZ + ts.tv_nsec / (1000000000 / TIMER_HZ);
+}
+
+// console output is buffered a line at a time; tftp progress lines end in '\r'
+void host_uart_flush(void)
+{
+    if(uart_buffer_used)
+        host_write(1, uart_buffer, uart_buffer_used);
+    uart_buffer_used = 0;
+}
+
+void uart_write_byte(char b)
+{
+    uart_buffer[uart_buffer_used++] = b;
+    if(b == '\n' || b == '\r' || uart_buffer_used == sizeof(uart_buffer))
+        host_uart_flush();
+}
+
+int uart_write_string(const char *str)
+{
+    int r = 0;
+
+    while(*str){
+        if(*str == '\n')
+            uart_write_byte('\r');
+        uart_write_byte(*(str++));
+        r++;
+    }
+
+    return r;
+}
+
+// there is no keyboard to poll: a benchmark run is stopped with ^C
+int uart_read_byte(void)
+{
+    return -1;
+}
+
+bool uart_check_cancel_key(void)
+{
+    return false;
+}
+
+void pretty_dump_memory(void *start, int len)
+{
+    uint8_t *ptr = start;
+
+    for(int i=0; i<len; i++)
+        printf("%s%02x", (i & 15) == 0 ? (i ? "\n  " : "  ") : " ", ptr[i]);
+    printf("\n");
+}
+
+// the portable checksum loop stands in for ipcsum68k.s
+uint32_t net_checksum_update(uint32_t sum, const void *data, unsigned int count)
+{
+    return net_checksum_update_c(sum, data, count);
+}
+
+bool load_reserve(uint32_t paddr, uint32_t size)
+{
+    if(paddr > host_load_size || size > host_load_size - paddr){
+        printf("Abort: address range error: beyond the %ld byte load area\n", host_load_size);
+        return false;
+    }
+    return true;
+}
+
+bool load_data_buffer(uint32_t paddr, const void *data, uint32_t size)
+{
+    if(!load_reserve(paddr, size))
+        return false;
+    if(data)
+        memcpy(host_load_area + paddr, data, size);
+    else
+        memset(host_load_area + paddr, 0, size);
+    return true;
+}
+
+void *load_data_pointer(uint32_t paddr, uint32_t size)
+{
+    if(paddr > host_load_size || size > host_load_size - paddr)
+        return NULL;
+    return host_load_area + paddr;
+}
@@ -0,0 +1,207 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <init.h>
+#include <cli.h>
+#include <net.h>
+#include "host.h"
+
+// Benchmark driver for the host build: brings the stack up on a TAP
+// interface (or replays a capture into it), runs TFTP or HTTP transfers and reports
+// the packet rate and the CPU time each packet cost.
+
+#define HOST_LOAD_AREA  (64 << 20)      // bytes of pretend target RAM for "load"
+#define DHCP_WAIT       10              // seconds
+#define HOST_CAPTURE_KB 1024            // netcap ring for -w
+#define MAX_ENV_ARGS    16
+
+static const macaddr_t host_default_macaddr = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+
+static void usage(void)
+{
+    printf("usage: gogoboot-host [options] get <server> <remote file> <local file>\n"
+           "                     [options] put <server> <local file> <remote file>\n"
+           "                     [options] load <server> <remote file>\n"
+           "                     [options] http [-c] <url> <local file>\n"
+           "options:\n"
+           "  -i <tap>        attach to TAP interface (default tap0)\n"
+           "  -r <pcap>       replay a capture as received traffic instead\n"
+           "  -m <mac>        our MAC address\n"
+           "  -a <ip>         our IPv4 address (default: use DHCP)\n"
+           "  -n <mask>       subnet mask (default 255.255.255.0)\n"
+           "  -g <ip>         gateway\n"
+           "  -c <count>      run the transfer count times\n"
+           "  -w <pcap>       capture the traffic with netcap and save it here\n"
+           "  -e <var=value>  set an environment variable, eg tftp_write_buffer=64\n"
+           "http -c resumes, appending to the local file if it exists\n");
+    host_exit(1);
+}
+
+static bool parse_macaddr(const char *str, macaddr_t mac)
+{
+    const char *end;
+
+    for(int i=0; i<6; i++){
+        mac[i] = strtoul(str, &end, 16);
+        if(end == str || (i < 5 ? *end != ':' : *end != 0))
+            return false;
+        str = end + 1;
+    }
+    return true;
+}
+
+static uint32_t cpu_time_us(void)
+{
+    struct host_timespec ts;
+
+    host_clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint32_t wall_time_us(void)
+{
+    struct host_timespec ts;
+
+    host_clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool wait_for_dhcp(void)
+{
+    timer_t timeout = set_timer_sec(DHCP_WAIT);
+
+    printf("waiting for DHCP ...\n");
+    while(!interface_ipv4_address){
+        if(timer_expired(timeout)){
+            printf("no DHCP lease\n");
+            return false;
+        }
+        net_pump();
+    }
+    return true;
+}
+
+static bool run_transfer(char *argv[], int argc)
+{
+    uint32_t server;
+
+    if(strcmp(argv[0], "http") == 0){
+        if(argc == 3)
+            return http_transfer(argv[1], argv[2], false);
+        if(argc == 4 && strcmp(argv[1], "-c") == 0)
+            return http_transfer(argv[2], argv[3], true);
+        usage();
+    }
+
+    server = net_parse_ipv4(argv[1]);
+    if(!server){
+        printf("cannot parse server address \"%s\"\n", argv[1]);
+        return false;
+    }
+    if(strcmp(argv[0], "get") == 0 && argc == 4)
+        return tftp_transfer(server, argv[2], argv[3], false);
+    if(strcmp(argv[0], "put") == 0 && argc == 4)
+        return tftp_transfer(server, argv[3], argv[2], true);
+    if(strcmp(argv[0], "load") == 0 && argc == 3)
+        return tftp_load(server, argv[2], 0, NULL);
+    usage();
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tap_name = "tap0", *replay_name = NULL, *capture_name = NULL;
+    uint32_t address = 0, mask = 0xffffff00, gateway = 0;
+    uint32_t cpu_start, wall_start, cpu_us, wall_ms, rx_start, tx_start, packets;
+    int count = 1, failures = 0, env_count = 0;
+    bool mac_set = false;
+    char *opt, *arg, *eq, *env_args[MAX_ENV_ARGS];
+
+    for(argc--, argv++; argc >= 2 && argv[0][0] == '-'; argc -= 2, argv += 2){
+        opt = argv[0];
+        arg = argv[1];
+        switch(opt[1]){
+            case 'i': tap_name = arg; break;
+            case 'r': replay_name = arg; break;
+            case 'a': address = net_parse_ipv4(arg); break;
+            case 'n': mask = net_parse_ipv4(arg); break;
+            case 'g': gateway = net_parse_ipv4(arg); break;
+            case 'c': count = atoi(arg); break;
+            case 'w': capture_name = arg; break;
+            case 'm':
+                if(!parse_macaddr(arg, interface_macaddr))
+                    usage();
+                mac_set = true;
+                break;
+            case 'e':
+                // applied once the heap is up
+                if(!strchr(arg, '=') || env_count >= MAX_ENV_ARGS)
+                    usage();
+                env_args[env_count++] = arg;
+                break;
+            default:
+                usage();
+        }
+    }
+    if(argc < 3)
+        usage();
+
+    host_init(MAXHEAP, HOST_LOAD_AREA);
+    for(int i=0; i<env_count; i++){
+        eq = strchr(env_args[i], '=');
+        *(eq++) = 0;
+        set_environment_variable(env_args[i], eq);
+    }
+    net_init();
+
+    if(address){
+        interface_ipv4_address = address;
+        interface_subnet_mask = mask;
+        interface_ipv4_gateway = gateway;
+    }
+
+    if(!replay_name && !mac_set)
+        memcpy(interface_macaddr, host_default_macaddr, sizeof(macaddr_t));
+    if(!host_eth_open(replay_name ? host_eth_replay : host_eth_tap, replay_name ? replay_name : tap_name) ||
+       !eth_init())
+        return 1;
+
+    if(!address){
+        dhcp_init();
+        if(!wait_for_dhcp())
+            return 1;
+    }
+
+    if(capture_name)
+        netcap_start(HOST_CAPTURE_KB, PACKET_MAXLEN); // whole frames, so the capture can be replayed
+
+    for(int run=0; run<count; run++){
+        cpu_start = cpu_time_us();
+        wall_start = wall_time_us();
+        rx_start = packet_rx_count;
+        tx_start = packet_tx_count;
+
+        if(!run_transfer(argv, argc))
+            failures++;
+
+        cpu_us = cpu_time_us() - cpu_start;
+        wall_ms = (wall_time_us() - wall_start) / 1000;
+        packets = (packet_rx_count - rx_start) + (packet_tx_count - tx_start);
+        if(wall_ms == 0)
+            wall_ms = 1; // avoid div 0
+        printf("host: %ld packets (%ld rx, %ld tx) in %ld ms: %ld packets/sec, %ld ms CPU",
+                packets, packet_rx_count - rx_start, packet_tx_count - tx_start,
+                wall_ms, packets * 1000 / wall_ms, cpu_us / 1000);
+        if(packets)
+            printf(", %ld.%02ld us CPU per packet", cpu_us / packets, (cpu_us % packets) * 100 / packets);
+        printf("\n");
+    }
+
+    if(capture_name)
+        netcap_save(capture_name);
+
+    eth_halt();
+    return failures ? 1 : 0;
+}
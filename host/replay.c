@@ -0,0 +1,213 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <net.h>
+#include "host.h"
+
+// Replay a classic pcap file, such as "netcap save" writes, as received
+// traffic. Files in either byte order are accepted.
+//
+// The capture holds both sides of the conversation. The frames the captured
+// machine sent itself are not delivered; instead each one holds the replay
+// until our stack has transmitted a frame of its own, so the replay keeps
+// pace with the stack much as the server kept pace with the board. Unless a
+// MAC address was given we take the captured machine's from the first frame
+// in the file sent from our IPv4 address, or failing that the first frame.
+//
+// A UDP client port is chosen at random for each transfer, so once we have
+// seen both the captured machine and our stack send a request to a server
+// port, replayed datagrams to the captured machine's client port are
+// redirected to ours.
+//
+// documentation:
+// https://wiki.wireshark.org/Development/LibpcapFileFormat
+// https://www.rfc-editor.org/rfc/rfc1624 - Computation of the Internet Checksum via Incremental Update
+
+#define PCAP_MAGIC              0xa1b2c3d4
+#define PCAP_MAGIC_SWAPPED      0xd4c3b2a1
+#define PCAP_LINKTYPE_ETHERNET  1
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_file_header_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_header_t;
+
+static int replay_fd = -1;
+static bool replay_swapped;
+static uint8_t replay_frame[PACKET_MAXLEN];
+static int replay_frame_length;         // a frame read but not yet delivered
+static int replay_credit;               // frames our stack sent that the capture has not yet caught up with
+static uint16_t replay_captured_port;   // the captured machine's client port
+static uint16_t replay_live_port;       // our stack's client port
+
+static uint32_t replay_word(uint32_t w)
+{
+    return replay_swapped ? __builtin_bswap32(w) : w;
+}
+
+static int replay_read_frame(void)
+{
+    pcap_record_header_t record;
+    uint32_t length, skip;
+
+    if(host_read(replay_fd, &record, sizeof(record)) != sizeof(record))
+        return 0;
+    length = replay_word(record.incl_len);
+    skip = 0;
+    if(length > sizeof(replay_frame)){
+        skip = length - sizeof(replay_frame);
+        length = sizeof(replay_frame);
+    }
+    if(length == 0 || host_read(replay_fd, replay_frame, length) != length)
+        return 0;
+    if(skip)
+        host_lseek(replay_fd, skip, SEEK_CUR);
+    return length;
+}
+
+static void replay_find_macaddr(void)
+{
+    const ethernet_header_t *eth = (const ethernet_header_t*)replay_frame;
+    const ipv4_header_t *ipv4 = (const ipv4_header_t*)eth->payload;
+    const arp_header_t *arp = (const arp_header_t*)eth->payload;
+    int length;
+    bool first = true;
+
+    while((length = replay_read_frame())){
+        if(length < sizeof(ethernet_header_t) + sizeof(arp_header_t))
+            continue;
+        if(first)
+            memcpy(interface_macaddr, eth->source_mac, sizeof(macaddr_t));
+        first = false;
+        if((ntohs(eth->ethertype) == ethertype_ipv4 && ntohl(ipv4->source_ip) == interface_ipv4_address) ||
+           (ntohs(eth->ethertype) == ethertype_arp && ntohl(arp->sender_ip) == interface_ipv4_address)){
+            memcpy(interface_macaddr, eth->source_mac, sizeof(macaddr_t));
+            return;
+        }
+    }
+}
+
+bool replay_open(const char *filename)
+{
+    static const macaddr_t zero_macaddr;
+    pcap_file_header_t header;
+
+    replay_fd = host_open(filename, O_RDONLY, 0);
+    if(replay_fd < 0){
+        printf("replay: cannot open \"%s\"\n", filename);
+        return false;
+    }
+
+    if(host_read(replay_fd, &header, sizeof(header)) != sizeof(header) ||
+       (header.magic != PCAP_MAGIC && header.magic != PCAP_MAGIC_SWAPPED)){
+        printf("replay: \"%s\" is not a pcap file\n", filename);
+        goto fail;
+    }
+    replay_swapped = (header.magic == PCAP_MAGIC_SWAPPED);
+    if(replay_word(header.network) != PCAP_LINKTYPE_ETHERNET){
+        printf("replay: \"%s\" does not hold ethernet frames\n", filename);
+        goto fail;
+    }
+
+    if(memcmp(interface_macaddr, zero_macaddr, sizeof(macaddr_t)) == 0){
+        replay_find_macaddr();
+        host_lseek(replay_fd, sizeof(header), SEEK_SET);
+    }
+    return true;
+
+fail:
+    host_close(replay_fd);
+    replay_fd = -1;
+    return false;
+}
+
+// the UDP header of a whole, unfragmented IPv4 datagram without options
+static udp_header_t *replay_udp_header(const uint8_t *frame, int length)
+{
+    const ethernet_header_t *eth = (const ethernet_header_t*)frame;
+    const ipv4_header_t *ipv4 = (const ipv4_header_t*)eth->payload;
+
+    if(length < sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) ||
+       ntohs(eth->ethertype) != ethertype_ipv4 || ipv4->version_length != 0x45 ||
+       ipv4->protocol != ip_proto_udp || (ntohs(ipv4->flags_and_frags) & 0x3fff) != 0)
+        return NULL;
+    return (udp_header_t*)ipv4->payload;
+}
+
+// a request to a server port: remember the client port it came from
+static void replay_learn_port(const uint8_t *frame, int length, uint16_t *client_port)
+{
+    udp_header_t *udp = replay_udp_header(frame, length);
+
+    if(udp && ntohs(udp->destination_port) < 1024)
+        *client_port = ntohs(udp->source_port);
+}
+
+static void replay_redirect(uint8_t *frame, int length)
+{
+    udp_header_t *udp = replay_udp_header(frame, length);
+    uint32_t sum;
+    uint16_t checksum;
+
+    if(!udp || !replay_live_port || ntohs(udp->destination_port) != replay_captured_port)
+        return;
+
+    // HC' = ~(~HC + ~m + m'), RFC 1624 eqn 3; zero means no checksum
+    if(udp->checksum){
+        sum = (uint16_t)~ntohs(udp->checksum) + (uint16_t)~replay_captured_port + replay_live_port;
+        sum = (sum & 0xffff) + (sum >> 16);
+        sum = (sum & 0xffff) + (sum >> 16);
+        checksum = ~sum;
+        udp->checksum = htons(checksum ? checksum : 0xffff);
+    }
+    udp->destination_port = htons(replay_live_port);
+}
+
+// our stack transmitted a frame
+void replay_transmitted(const uint8_t *frame, int length)
+{
+    replay_credit++;
+    replay_learn_port(frame, length, &replay_live_port);
+}
+
+// the next frame to deliver, or 0 if we are waiting for our stack or at the end of the file
+int replay_next_frame(uint8_t *buffer, int size)
+{
+    int length;
+
+    for(;;){
+        length = replay_frame_length ? replay_frame_length : replay_read_frame();
+        replay_frame_length = length;
+        if(!length)
+            return 0;
+        if(length < sizeof(ethernet_header_t) ||
+           memcmp(((ethernet_header_t*)replay_frame)->source_mac, interface_macaddr, sizeof(macaddr_t)) != 0)
+            break;
+        // one the captured machine sent
+        if(!replay_credit)
+            return 0;
+        replay_credit--;
+        replay_learn_port(replay_frame, length, &replay_captured_port);
+        replay_frame_length = 0;
+    }
+
+    replay_frame_length = 0;
+    replay_redirect(replay_frame, length);
+    if(length > size)
+        length = size;
+    memcpy(buffer, replay_frame, length);
+    return length;
+}
@@ -0,0 +1,109 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include "host.h"
+
+int main(int argc, char *argv[]);
+
+// the kernel enters here with argc and then argv[] on the stack
+__asm__(
+    ".globl _start\n"
+    "_start:\n"
+    "    xorl %ebp, %ebp\n"
+    "    movl %esp, %eax\n"
+    "    andl $-16, %esp\n"
+    "    subl $12, %esp\n"
+    "    pushl %eax\n"
+    "    call host_start\n"
+    "    hlt\n");
+
+void host_start(uint32_t *stack) __attribute__((noreturn, used));
+void host_start(uint32_t *stack)
+{
+    host_exit(main(stack[0], (char**)(stack + 1)));
+}
+
+long host_syscall(long number, long a, long b, long c)
+{
+    long r;
+
+    __asm__ volatile("int $0x80"
+            : "=a" (r)
+            : "a" (number), "b" (a), "c" (b), "d" (c)
+            : "memory");
+    return r;
+}
+
+void host_exit(int status)
+{
+    host_uart_flush();
+    for(;;)
+        host_syscall(SYS_exit_group, status, 0, 0);
+}
+
+void halt(void)
+{
+    printf("halted.\n");
+    host_exit(1);
+}
+
+int host_read(int fd, void *buffer, int length)
+{
+    return host_syscall(SYS_read, fd, (long)buffer, length);
+}
+
+int host_write(int fd, const void *buffer, int length)
+{
+    return host_syscall(SYS_write, fd, (long)buffer, length);
+}
+
+int host_open(const char *path, int flags, int mode)
+{
+    return host_syscall(SYS_open, (long)path, flags, mode);
+}
+
+int host_close(int fd)
+{
+    return host_syscall(SYS_close, fd, 0, 0);
+}
+
+long host_lseek(int fd, long offset, int whence)
+{
+    return host_syscall(SYS_lseek, fd, offset, whence);
+}
+
+int host_ioctl(int fd, unsigned long request, void *arg)
+{
+    return host_syscall(SYS_ioctl, fd, request, (long)arg);
+}
+
+int host_poll(struct host_pollfd *fds, int count, int timeout_ms)
+{
+    return host_syscall(SYS_poll, (long)fds, count, timeout_ms);
+}
+
+void host_clock_gettime(int clock, struct host_timespec *ts)
+{
+    host_syscall(SYS_clock_gettime, clock, (long)ts, 0);
+}
+
+void *host_mmap(uint32_t size)
+{
+    long r;
+
+    // mmap2 takes six arguments, more than host_syscall() passes
+    __asm__ volatile("pushl %%ebp\n"
+                     "xorl %%ebp, %%ebp\n"  // offset
+                     "int $0x80\n"
+                     "popl %%ebp"
+            : "=a" (r)
+            : "a" (SYS_mmap2), "b" (0), "c" (size),
+              "d" (3),                  // PROT_READ | PROT_WRITE
+              "S" (0x22),               // MAP_PRIVATE | MAP_ANONYMOUS
+              "D" (-1)
+            : "memory");
+    if((unsigned long)r >= (unsigned long)-4095)
+        return NULL;
+    return (void*)r;
+}
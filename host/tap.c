@@ -0,0 +1,44 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include "host.h"
+
+// Attach to a Linux TAP interface. Each read() returns one whole ethernet
+// frame and each write() sends one, so the interface looks to us much like
+// the NE2000 does. Creating the interface needs CAP_NET_ADMIN; create it
+// beforehand with "ip tuntap add mode tap user $USER" and we need none.
+
+#define TUNSETIFF       0x400454ca
+#define IFF_TAP         0x0002
+#define IFF_NO_PI       0x1000
+
+struct host_ifreq {
+    char name[16];
+    short flags;
+    char pad[14];
+};
+
+int tap_open(const char *name)
+{
+    struct host_ifreq ifr;
+    int fd, r;
+
+    fd = host_open("/dev/net/tun", O_RDWR | O_NONBLOCK, 0);
+    if(fd < 0){
+        printf("tap: cannot open /dev/net/tun (error %d)\n", -fd);
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.name, name, sizeof(ifr.name) - 1);
+    ifr.flags = IFF_TAP | IFF_NO_PI;
+    r = host_ioctl(fd, TUNSETIFF, &ifr);
+    if(r < 0){
+        printf("tap: cannot attach to \"%s\" (error %d)\n", name, -r);
+        host_close(fd);
+        return -1;
+    }
+
+    return fd;
+}
@@ -19,6 +19,9 @@ void f_perror(int errno);
 // execute loaded code (wrapper that ultimately calls machine_execute)
 void execute(void *entry_vector, int argc, char **argv);
 FRESULT load_data(FIL *fd, uint32_t paddr, uint32_t offset, uint32_t file_size, uint32_t size);
+bool load_reserve(uint32_t paddr, uint32_t size);
+bool load_data_buffer(uint32_t paddr, const void *data, uint32_t size); // data=NULL writes zeroes
+void *load_data_pointer(uint32_t paddr, uint32_t size); // NULL unless the range can be written directly
 
 typedef struct
 {
@@ -32,6 +35,9 @@ typedef struct
 extern const cmd_entry_t target_cmd_table[];
 extern const cmd_entry_t builtin_cmd_table[];
 
+// cli.c
+void execute_script_buffer(const char *name, const char *script, int length);
+
 // cli_fs.c
 void do_cd(char *argv[], int argc);
 void do_ls(char *argv[], int argc);
@@ -56,11 +62,24 @@ void memory_test(uint32_t base, uint32_t size);
 void help(char *argv[], int argc);
 void do_meminfo(char *argv[], int argc);
 void do_netinfo(char *argv[], int argc);
+void do_netcap(char *argv[], int argc);
+void do_diskcache(char *argv[], int argc);
+void do_diskbench(char *argv[], int argc);
+void do_cksumbench(char *argv[], int argc);
+void do_rxbench(char *argv[], int argc);
 void do_date(char *argv[], int argc);
 
 // cli_tftp.c
 void do_tftp_get(char *argv[], int argc);
 void do_tftp_put(char *argv[], int argc);
+void do_tftp_load(char *argv[], int argc);
+void do_tftp_boot(char *argv[], int argc);
+void do_netboot(char *argv[], int argc);
+bool netboot(bool autoboot);
+
+// cli_http.c
+void do_http_get(char *argv[], int argc);
+void do_http_load(char *argv[], int argc);
 
 // cli_load.c
 void do_execute(char *argv[], int argc);
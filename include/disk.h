@@ -14,12 +14,16 @@ void ide_set_register(disk_controller_t *ctrl, int reg, uint8_t val);
 uint8_t ide_get_register(disk_controller_t *ctrl, int reg);
 void ide_transfer_sector_write(disk_controller_t *ctrl, const void *buff);
 void ide_transfer_sector_read(disk_controller_t *ctrl, void *buff);
+void ide_transfer_block_write(disk_controller_t *ctrl, const void *buff, int nsectors);
+void ide_transfer_block_read(disk_controller_t *ctrl, void *buff, int nsectors);
 
 /* common ide code provides this type */
 typedef struct disk_t {
     disk_controller_t *ctrl;
     int disk;               /* 0 = master, 1 = slave */
     uint32_t sectors;       /* 32 bits limits us to 2TB */
+    int multiple;           /* sectors per DRQ block; 1 = READ/WRITE MULTIPLE not in use */
+    bool flush_cache;       /* drive supports FLUSH CACHE */
     DSTATUS fat_fs_status;
     FATFS fat_fs_workarea;
 } disk_t;
@@ -30,6 +34,34 @@ disk_t *disk_get_info(int nr);
 int disk_get_count(void);
 bool disk_data_read(int disk, void *buff, uint32_t sector, int sector_count);
 bool disk_data_write(int disk, const void *buff, uint32_t sector, int sector_count);
+bool disk_flush_cache(int disk);
 void disk_controller_startup(disk_controller_t *ctrl);
 
+/* sector cache (diskcache.c) sits between FatFs and the methods above */
+#define DISK_CACHE_FAT  0
+#define DISK_CACHE_DIR  1
+#define DISK_CACHE_DATA 2
+#define DISK_CACHE_KINDS 3
+
+typedef struct {
+    uint32_t hits[DISK_CACHE_KINDS];
+    uint32_t misses[DISK_CACHE_KINDS];
+    uint32_t readahead;     /* sectors read ahead into the cache */
+    uint32_t uncached;      /* sectors read straight into the caller's buffer */
+    uint32_t writes;        /* sectors written */
+    uint32_t evictions;
+    uint32_t writeback;     /* dirty sectors written back */
+    uint32_t writeback_commands;
+} disk_cache_stats_t;
+
+extern disk_cache_stats_t disk_cache_stats;
+bool disk_cache_read(int disk, void *buff, uint32_t sector, int sector_count);
+bool disk_cache_write(int disk, const void *buff, uint32_t sector, int sector_count);
+void disk_cache_invalidate(int disk, uint32_t sector, int sector_count);
+bool disk_cache_sync(int disk);     /* write back dirty sectors, then FLUSH CACHE */
+bool disk_cache_sync_all(void);
+bool disk_cache_drop(void); /* sync and discard the cache; it is set up again on next use */
+void disk_cache_status(void);
+void disk_cache_reset_stats(void);
+
 #endif
@@ -1,9 +1,9 @@
 #ifndef __GOGOBOOT_KISS_IDE_DOT_H__
 #define __GOGOBOOT_KISS_IDE_DOT_H__
 
-/* idexfer.s */
-void ide_sector_xfer_input(void *buf, volatile uint8_t *port);
-void ide_sector_xfer_output(const void *buf, volatile uint8_t *port);
+/* ppidexfer.s */
+void ide_block_xfer_input(void *buf, volatile uint8_t *port, int nsectors);
+void ide_block_xfer_output(const void *buf, volatile uint8_t *port, int nsectors);
 
 struct disk_controller_t
 {
@@ -16,6 +16,9 @@
 /* IDE command codes */
 #define IDE_CMD_READ_SECTOR     0x20
 #define IDE_CMD_WRITE_SECTOR    0x30
+#define IDE_CMD_READ_MULTIPLE   0xC4
+#define IDE_CMD_WRITE_MULTIPLE  0xC5
+#define IDE_CMD_SET_MULTIPLE    0xC6
 #define IDE_CMD_FLUSH_CACHE     0xE7
 #define IDE_CMD_IDENTIFY        0xEC
 #define IDE_CMD_SET_FEATURES    0xEF
@@ -50,6 +53,7 @@ enum {
         ATA_ID_MAX_MULTSECT = 2*47,
         ATA_ID_MULTSECT     = 2*59,
         ATA_ID_LBA_CAPACITY = 2*60,
+        ATA_ID_COMMAND_SET_2 = 2*83,
 };
 
 #endif
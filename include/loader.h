@@ -3,5 +3,7 @@
 
 bool load_m68k_executable(char *argv[], int argc, FIL *fd);
 bool load_elf_executable(char *arg[], int numarg, FIL *fd);
+bool load_elf_executable_tftp(char *argv[], int argc, uint32_t tftp_server_ip, const char *tftp_filename);
+bool load_netboot_tftp(uint32_t tftp_server_ip, const char *tftp_filename); // ELF or script
 
 #endif
@@ -74,22 +74,25 @@ are GPL, so this is, of course, GPL.
 
 #include <types.h>
 
+#define NE2000_TX_SLOTS_MAX 8
+#define NE2000_TX_SLOT_PAGES 6 /* 6x256=1.5KB, room for a full frame */
+
 typedef struct dp83902a_priv_data {
     uint16_t base;
     uint16_t data;
     bool rtl8019;
-    int tx_next;           /* First free Tx page */
-    int tx_int;            /* Expecting interrupt from this buffer */
     int rx_next;           /* First free Rx page */
-    int tx1, tx2;          /* Page numbers for Tx buffers */
-    /* unsigned long tx1_key, tx2_key;   // Used to ack when packet sent */
-    int tx1_len, tx2_len;
+    int tx_head;           /* Oldest queued Tx slot; being sent if tx_started */
+    int tx_count;          /* Tx slots holding a frame */
+    int tx_len[NE2000_TX_SLOTS_MAX];
     bool tx_started, running;
     uint8_t esa[6];
+    uint8_t mar[8];        /* Multicast hash filter (MAR0-7) */
     void* plf_priv;
 
     /* Buffer allocation */
-    int tx_buf1, tx_buf2;
+    int tx_buf_start;      /* First page of the Tx ring */
+    int tx_slots;          /* Tx ring size, in NE2000_TX_SLOT_PAGES slots */
     int rx_buf_start, rx_buf_end;
 } dp83902a_priv_data_t;
 
@@ -352,4 +355,9 @@ static void dp83902a_poll(void);
 #define PCNET_RESET     0x1f    /* Issue a read to reset, a write to clear. */
 #define PCNET_MISC      0x18    /* For IBM CCAE and Socket EA cards */
 
+/* ne2000xfer.s -- data port block transfers, one implementation per bus */
+void ne2000_pio_input(void *buf, volatile void *port, unsigned int len);
+uint32_t ne2000_pio_input_sum(void *buf, volatile void *port, unsigned int len);
+void ne2000_pio_output(const void *buf, volatile void *port, unsigned int len);
+
 #endif
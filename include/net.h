@@ -3,6 +3,7 @@
 
 #include <types.h>
 #include <timers.h>
+#include <fatfs/ff.h>
 
 typedef struct packet_t packet_t;
 typedef struct packet_queue_t packet_queue_t;
@@ -13,6 +14,7 @@ typedef struct ipv4_header_t ipv4_header_t;
 typedef struct udp_header_t udp_header_t;
 typedef struct tcp_header_t tcp_header_t;
 typedef struct icmp_header_t icmp_header_t;
+typedef struct igmp_header_t igmp_header_t;
 typedef uint8_t macaddr_t[6];
 
 extern macaddr_t const broadcast_macaddr;
@@ -23,12 +25,33 @@ extern uint32_t interface_ipv4_address;
 extern uint32_t interface_subnet_mask;
 extern uint32_t interface_ipv4_gateway;
 extern uint32_t interface_dns_server;
+#define DHCP_BOOT_FILE_MAX 128
+extern uint32_t interface_boot_server;
+extern char interface_boot_file[DHCP_BOOT_FILE_MAX];
 
 extern uint32_t packet_alive_count;
 extern uint32_t packet_discard_count;
 extern uint32_t packet_bad_cksum_count;
+extern uint32_t packet_bad_ipv4_cksum_count;
+extern uint32_t packet_bad_udp_cksum_count;
+extern uint32_t packet_bad_tcp_cksum_count;
+extern uint32_t packet_bad_icmp_cksum_count;
+extern uint32_t packet_bad_igmp_cksum_count;
 extern uint32_t packet_rx_count;
 extern uint32_t packet_tx_count;
+extern int packet_pool_size;
+extern uint32_t packet_pool_high_water;
+extern uint32_t packet_pool_exhausted_count;
+extern int packet_txqueue_length;
+extern int packet_txqueue_high_water;
+
+// Histogram of times measured with gogoboot_read_timer(). Bucket 0 counts
+// times under one tick, bucket n times of 2^(n-1) to 2^n-1 ticks, and the
+// last bucket everything longer.
+#define NET_HISTOGRAM_BUCKETS 8
+typedef struct {
+    uint32_t bucket[NET_HISTOGRAM_BUCKETS];
+} net_histogram_t;
 
 struct packet_t {
     packet_t *next;               // used by packet_queue_t to create linked lists
@@ -40,8 +63,11 @@ struct packet_t {
     udp_header_t *udp;            // set for ipv4 udp
     tcp_header_t *tcp;            // set for ipv4 tcp
     icmp_header_t *icmp;          // set for ipv4 icmp
-    uint16_t data_length;         // set for ipv4 udp, tcp
-    uint8_t *data;                // set for ipv4 udp, tcp
+    uint16_t data_length;         // set for ipv4 udp, tcp, icmp, igmp
+    uint8_t *data;                // set for ipv4 udp, tcp, icmp, igmp
+    uint32_t rx_sum;              // one's complement sum of buffer[], if packet_flag_rx_sum_valid
+    uint8_t *rx_direct;           // rest of the frame, if packet_flag_rx_direct
+    uint16_t rx_direct_length;    // length of the frame at rx_direct
     uint16_t buffer_length_alloc; // length allocated for buffer[]
     uint16_t buffer_length;       // length used by buffer[] (buffer_length <= length_alloc)
     uint8_t buffer[];             // must be final member of data structure
@@ -49,6 +75,9 @@ struct packet_t {
 
 static const uint32_t packet_flag_destination_mac_valid = 1;
 static const uint32_t packet_flag_nexthop_resolved = 2;
+static const uint32_t packet_flag_rx_sum_valid = 4;     // driver computed rx_sum during the copy
+static const uint32_t packet_flag_rx_direct = 8;        // buffer[] holds only the headers, the payload went to rx_direct
+static const uint32_t packet_flag_arp_wait = 16;        // counted as an ARP miss already
 
 struct __attribute__((packed, aligned(2))) ethernet_header_t {
     macaddr_t destination_mac;
@@ -93,6 +122,7 @@ struct __attribute__((packed, aligned(2))) ipv4_header_t {
 };
 
 static const uint8_t ip_proto_icmp = 1;
+static const uint8_t ip_proto_igmp = 2;
 static const uint8_t ip_proto_tcp  = 6;
 static const uint8_t ip_proto_udp  = 17;
 
@@ -112,20 +142,46 @@ struct __attribute__((packed, aligned(2))) icmp_header_t {
     uint8_t payload[];          // finally we get to the actual user data
 };
 
+struct __attribute__((packed, aligned(2))) igmp_header_t {
+    uint8_t type;               // igmp_type_*
+    uint8_t max_response_time;  // in 1/10 second, queries only
+    uint16_t checksum;          // one's complement sum of the IGMP message
+    uint32_t group;
+};
+
+static const uint8_t igmp_type_query     = 0x11;
+static const uint8_t igmp_type_v2_report = 0x16;
+static const uint8_t igmp_type_v2_leave  = 0x17;
+
 struct __attribute__((packed, aligned(2))) tcp_header_t {
     uint16_t source_port;
     uint16_t destination_port;
     uint32_t sequence;
     uint32_t ack;
-    uint8_t data_offset;
+    uint8_t data_offset;        // top 4 bits = header length in 32-bit words
+    uint8_t flags;              // tcp_flag_*
     uint16_t window_size;
-    uint16_t checksum;
-    // optional urgent pointer
+    uint16_t checksum;          // one's complement sum of pseudo-header and whole segment, like UDP
+    uint16_t urgent_pointer;
     uint8_t options[];          // variable length
     // followed by the user data
 };
 
+static const uint8_t tcp_flag_fin = 0x01;
+static const uint8_t tcp_flag_syn = 0x02;
+static const uint8_t tcp_flag_rst = 0x04;
+static const uint8_t tcp_flag_psh = 0x08;
+static const uint8_t tcp_flag_ack = 0x10;
+
 #define PACKET_MAXLEN 1536      /* largest size we will process */
+
+#ifndef PACKET_POOL_SIZE        /* number of preallocated PACKET_MAXLEN buffers */
+#if defined(TARGET_MINI)
+#define PACKET_POOL_SIZE 16
+#else
+#define PACKET_POOL_SIZE 32
+#endif
+#endif
 #define DEFAULT_TTL 64
 
 struct packet_queue_t {
@@ -135,6 +191,7 @@ struct packet_queue_t {
 
 struct packet_sink_t {
     packet_sink_t *next; // for linked lists
+    packet_sink_t *demux_next; // for net.c demux table chains
     void *sink_private;  // for sink's use
 
     bool match_interface_local_ip; // similar to match_local_ip, but using the current 'interface_ipv4_address'
@@ -144,13 +201,19 @@ struct packet_sink_t {
     uint16_t match_remote_port;
     uint16_t match_ethertype;
     uint8_t  match_ipv4_protocol;
+    uint8_t  match_score; // number of match_* fields set; computed by net_add_packet_sink
 
     uint32_t packets_queued;
+    int queue_high_water;
     packet_queue_t queue;
     void (*cb_packet_received)(packet_sink_t *sink, packet_t *packet);
 
     timer_t timer;
     void (*cb_timer_expired)(packet_sink_t *sink);
+
+    // see net_set_rx_direct_sink()
+    int rx_direct_header;          // bytes of UDP payload to look at before placing the rest; must be even
+    uint8_t *(*cb_rx_direct)(packet_sink_t *sink, const uint8_t *header, int length);
 };
 
 /* ne2000.c */
@@ -159,28 +222,42 @@ void eth_halt(void);
 void eth_pump(void); // called from net_pump
 bool eth_attempt_tx(packet_t *packet); // returns true if transmission started; caller must free packet.
 int eth_rxbuffer_size(void); // in bytes
+int eth_rxbuffer_free(void); // in bytes
+void eth_rx_benchmark(void);
+void eth_dump_stats(void);
+void eth_reset_stats(void);
+void eth_set_multicast_list(const macaddr_t *list, int count); // replaces the receive filter
 
 /* net.c -- interface with ne2000.c */
 void net_eth_push(packet_t *packet);
 packet_t *net_eth_pull(void);
 void net_add_packet_sink(packet_sink_t *c);
 void net_remove_packet_sink(packet_sink_t *c);
+int net_rx_direct_header_length(void); // frame bytes the driver must read before net_rx_direct_target(), 0 if no hint
+uint8_t *net_rx_direct_target(packet_t *packet); // where to put the rest of the frame, or NULL
 
 /* net.c */
 void net_init(void);
 void net_pump(void);
 void net_tx(packet_t *packet);
 void net_dump_packet_sinks(void);
+void net_reset_stats(void); // zero the counters and histograms
+void net_histogram_add(net_histogram_t *h, timer_t ticks);
+void net_histogram_print(const char *name, const net_histogram_t *h);
+void net_set_rx_direct_sink(packet_sink_t *sink); // NULL to clear
 
 /* packet.c, ipv4.c */
+void packet_pool_init(void);
 packet_t *packet_alloc(int buffer_size);
 packet_t *packet_create_tcp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size);
 packet_t *packet_create_udp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size);
 packet_t *packet_create_icmp(uint32_t dest_ipv4, int data_size);
+packet_t *packet_create_igmp(uint32_t dest_ipv4, int data_size);
 packet_t *packet_create_for_sink(packet_sink_t *sink, int data_size);
 bool packet_data_resize(packet_t *packet, int new_data_length);
 void packet_free(packet_t *packet);
 uint32_t net_parse_ipv4(const char *str);
+void net_format_ipv4(char *buffer, uint32_t ip); // dotted quad, buffer of at least 16 bytes
 void packet_set_destination_mac(packet_t *packet, const macaddr_t *mac);
 
 // for dynamically allocated queues
@@ -204,21 +281,92 @@ void net_compute_tcp_checksum(packet_t *packet);
 
 bool net_verify_ipv4_checksum(packet_t *packet);
 bool net_verify_icmp_checksum(packet_t *packet);
+bool net_verify_igmp_checksum(packet_t *packet);
 bool net_verify_udp_checksum(packet_t *packet);
 bool net_verify_tcp_checksum(packet_t *packet);
 
+uint32_t net_checksum_update(uint32_t sum, const void *addr, unsigned int count); /* ipcsum68k.s */
+uint32_t net_checksum_update_c(uint32_t sum, const void *addr, unsigned int count);
+uint16_t net_checksum_fold(uint32_t sum);
+
 /* dhcp.c */
 void dhcp_init(void);
+bool dhcp_enabled(void); // false if there is no network interface
 
 /* icmp.c */
 void net_icmp_init(void);
 
+/* igmp.c */
+bool net_multicast_join(uint32_t group); // receive traffic for an IPv4 multicast group
+void net_multicast_leave(uint32_t group);
+void net_multicast_macaddr(uint32_t group, macaddr_t mac);
+static inline bool net_ipv4_is_multicast(uint32_t ip) { return (ip & 0xf0000000) == 0xe0000000; }
+
+/* netcap.c */
+extern bool netcap_active;
+bool netcap_start(int kbytes, int snaplen); // 0 for the defaults
+void netcap_stop(void);
+void netcap_status(void);
+bool netcap_save(const char *filename); // as a pcap file
+void netcap_record(packet_t *packet);
+static inline void netcap_packet(packet_t *packet) { if(netcap_active) netcap_record(packet); }
+
 /* arp.c */
 typedef enum { arp_okay, arp_wait, arp_fail } arp_result_t;
+extern uint32_t arp_hit_count;     // packets addressed from the cache
+extern uint32_t arp_miss_count;    // packets that had to wait for resolution
+extern uint32_t arp_stall_count;   // ... because an entry in use had expired
+extern uint32_t arp_refresh_count; // refresh queries sent for entries in use
 void net_arp_init(void);
 arp_result_t net_arp_resolve(packet_t *packet);
+void net_arp_dump_cache(void);
+
+/* tcp.c */
+typedef struct tcp_connection_t tcp_connection_t;
+// data callback for received data, called in sequence order; return false to abort the connection
+typedef bool (*tcp_data_cb_t)(void *cb_private, const void *data, int length);
+tcp_connection_t *tcp_connect(uint32_t remote_ip, uint16_t remote_port, tcp_data_cb_t data_cb, void *data_cb_private);
+int tcp_send(tcp_connection_t *conn, const void *data, int length); // returns number of bytes queued
+int tcp_send_pending(tcp_connection_t *conn); // bytes queued but not yet acknowledged
+void tcp_close(tcp_connection_t *conn);  // send FIN once queued data is sent
+void tcp_abort(tcp_connection_t *conn);  // send RST
+void tcp_free(tcp_connection_t *conn);   // aborts the connection if still open
+bool tcp_established(tcp_connection_t *conn);
+bool tcp_remote_closed(tcp_connection_t *conn); // peer has sent FIN, or the connection is gone
+bool tcp_closed(tcp_connection_t *conn);
+const char *tcp_error(tcp_connection_t *conn); // NULL unless the connection failed
+
+/* writebuf.c */
+// collects received file data and writes it out in whole clusters
+typedef struct {
+    FIL *file;
+    const char *filename;   // for error messages
+    const char *owner;      // prefix for error messages, eg "tftp"
+    uint8_t *buffer;        // NULL when each piece is written straight to the file
+    int size;               // a whole number of clusters
+    int used;
+    int limit;              // flush when used reaches this; less than size until we reach a cluster boundary
+    uint32_t write_ticks;   // time spent in f_write()
+} write_buffer_t;
+void write_buffer_init(write_buffer_t *wb, const char *owner, FIL *file, const char *filename, int kbytes); // kbytes <= 0 for no buffer
+void write_buffer_free(write_buffer_t *wb);
+bool write_buffer_write(write_buffer_t *wb, const void *data, int size);
+bool write_buffer_flush(write_buffer_t *wb);
+bool write_buffer_write_file(write_buffer_t *wb, const void *data, int size); // bypasses the buffer
+
+/* http.c */
+// data callback for http_receive(); return false to abort the transfer. total_size is 0 if unknown.
+typedef bool (*http_data_cb_t)(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size);
+bool http_transfer(const char *url, const char *disk_filename, bool resume); // resume appends to an existing file
+bool http_receive(const char *url, http_data_cb_t data_cb, void *data_cb_private);
+bool http_load(const char *url, uint32_t load_address, uint32_t *load_size); // to memory, no disk
 
 /* tftp.c */
+// data callback for tftp_receive(), called with the data in file order; return false to abort the transfer
+typedef bool (*tftp_data_cb_t)(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size);
 bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, const char *disk_filename, bool is_put);
+bool tftp_receive(uint32_t tftp_server_ip, const char *tftp_filename, tftp_data_cb_t data_cb, void *data_cb_private);
+bool tftp_load(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t load_address, uint32_t *load_size); // to memory, no disk
+extern net_histogram_t tftp_ack_rtt_histogram; // from sending an ACK (get) or window (put) to the server's response
 
 #endif
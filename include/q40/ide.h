@@ -1,6 +1,10 @@
 #ifndef __GOGOBOOT_Q40_IDE_DOT_H__
 #define __GOGOBOOT_Q40_IDE_DOT_H__
 
+/* idexfer.s */
+void ide_block_xfer_input(void *buf, volatile uint16_t *port, int nsectors);
+void ide_block_xfer_output(const void *buf, volatile uint16_t *port, int nsectors);
+
 struct disk_controller_t
 {
     uint16_t base_io;
@@ -23,7 +23,7 @@ typedef uint32_t                size_t;
 #endif
 
 /* network byte ordering functions */
-#if __BYTE_ORDER == __BIG_ENDIAN
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
 #define ntohl(x)        ((uint32_t)(x))
 #define ntohs(x)        ((uint16_t)(x))
 #define htonl(x)        ((uint32_t)(x))
@@ -37,11 +37,11 @@ typedef uint32_t                size_t;
 #define cpu_to_be32(x)  ((uint32_t)(x))
 #define be32_to_cpu(x)  ((uint32_t)(x))
 #else
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-#define ntohl(x)        (__builtin_bswap_32((uint32_t)(x)))
-#define ntohs(x)        (__builtin_bswap_16((uint16_t)(x)))
-#define htonl(x)        (__builtin_bswap_32((uint32_t)(x)))
-#define htons(x)        (__builtin_bswap_16((uint16_t)(x)))
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define ntohl(x)        (__builtin_bswap32((uint32_t)(x)))
+#define ntohs(x)        (__builtin_bswap16((uint16_t)(x)))
+#define htonl(x)        (__builtin_bswap32((uint32_t)(x)))
+#define htons(x)        (__builtin_bswap16((uint16_t)(x)))
 #define cpu_to_le16(x)  ((uint16_t)(x))
 #define le16_to_cpu(x)  ((uint16_t)(x))
 #define cpu_to_le32(x)  ((uint32_t)(x))
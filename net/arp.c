@@ -11,24 +11,88 @@
 #define CACHE_FLUSH_INTERVAL 15
 #define MAX_RESOLVE_ATTEMPTS 10
 #define QUERY_INTERVAL 500
+#define REFRESH_BEFORE  15      // seconds before expiry that we start to refresh an entry in use
+#define REFRESH_INTERVAL 1000   // ms between refresh queries
 
 #define HARDWARE_TYPE_ETHERNET 1
 #define PROTOCOL_TYPE_IPV4 0x800
 
+// The cache is a fixed table, hashed on the IPv4 address into buckets of a
+// few entries each. When a bucket is full we reuse the dead or least
+// recently used entry. Entries that are in use are refreshed with a unicast
+// query (RFC 1122 2.3.2.1) before they expire, so a long transfer to the
+// same server or gateway never has to stop and wait for ARP.
+#define ARP_BUCKETS 8           // must be a power of two
+#define ARP_WAYS    4           // entries per bucket
+
 static packet_sink_t *sink;
 
 typedef struct arp_cache_entry_t arp_cache_entry_t;
 
 struct arp_cache_entry_t {
-    arp_cache_entry_t *next;
-    uint32_t ipv4_address;
+    uint32_t ipv4_address;      // 0 if the entry is free
     macaddr_t mac_address;
     bool valid;
+    bool stale;                 // expired while in use; waiting packets count as stalls
     int resolve_attempts;
-    timer_t next_event;
+    timer_t next_event;         // valid: when it expires; resolving: when to query again
+    timer_t refresh;            // valid: when to start refreshing it, if it is used
+    timer_t last_used;
 };
 
-static arp_cache_entry_t *cache_list_head;
+static arp_cache_entry_t arp_cache[ARP_BUCKETS][ARP_WAYS];
+
+uint32_t arp_hit_count = 0;
+uint32_t arp_miss_count = 0;
+uint32_t arp_stall_count = 0;
+uint32_t arp_refresh_count = 0;
+
+static arp_cache_entry_t *arp_cache_bucket(uint32_t ip)
+{
+    return arp_cache[(ip ^ (ip >> 8)) & (ARP_BUCKETS - 1)];
+}
+
+static arp_cache_entry_t *arp_cache_lookup(uint32_t ip)
+{
+    arp_cache_entry_t *entry = arp_cache_bucket(ip);
+
+    for(int i=0; i<ARP_WAYS; i++, entry++)
+        if(entry->ipv4_address == ip)
+            return entry;
+
+    return NULL;
+}
+
+static bool arp_entry_dead(arp_cache_entry_t *entry)
+{
+    return (entry->valid && timer_expired(entry->next_event)) || // valid but timed out
+           (!entry->valid && entry->resolve_attempts >= MAX_RESOLVE_ATTEMPTS); // resolve failed
+}
+
+// pick an entry for ip in its bucket: a free one, else a dead one, else the least recently used
+static arp_cache_entry_t *arp_cache_allocate(uint32_t ip)
+{
+    arp_cache_entry_t *entry = arp_cache_bucket(ip), *victim = NULL;
+    timer_t now = gogoboot_read_timer();
+
+    for(int i=0; i<ARP_WAYS; i++, entry++){
+        if(entry->ipv4_address == 0 || arp_entry_dead(entry)){
+            victim = entry;
+            break;
+        }
+        if(!victim || now - entry->last_used > now - victim->last_used)
+            victim = entry;
+    }
+
+#ifdef ARP_DEBUG
+    if(victim->ipv4_address)
+        printf("arp: replacing entry for ip 0x%08lx\n", victim->ipv4_address);
+#endif
+    memset(victim, 0, sizeof(arp_cache_entry_t));
+    victim->ipv4_address = ip;
+    victim->last_used = now;
+    return victim;
+}
 
 static packet_t *packet_create_arp(void)
 {
@@ -52,14 +116,7 @@ static packet_t *packet_create_arp(void)
 
 static void update_arp_cache(uint32_t ip, macaddr_t *mac, bool add_entry)
 {
-    arp_cache_entry_t *entry = cache_list_head;
-
-    while(entry){
-        if(entry->ipv4_address == ip)
-            break;
-        else
-            entry = entry->next;
-    }
+    arp_cache_entry_t *entry = arp_cache_lookup(ip);
 
     if(entry == NULL){
 #ifdef ARP_DEBUG
@@ -70,19 +127,18 @@ static void update_arp_cache(uint32_t ip, macaddr_t *mac, bool add_entry)
 #ifdef ARP_DEBUG
         printf("arp: creating entry for ip 0x%08lx\n", ip);
 #endif
-        entry = malloc(sizeof(arp_cache_entry_t));
-        entry->next = cache_list_head;
-        cache_list_head = entry;
+        entry = arp_cache_allocate(ip);
     }
 
 #ifdef ARP_DEBUG
     printf("arp: updating entry for ip 0x%08lx\n", ip);
 #endif
-    entry->ipv4_address = ip;
     memcpy(entry->mac_address, mac, sizeof(macaddr_t));
     entry->valid = true;
+    entry->stale = false;
     entry->resolve_attempts = 0;
     entry->next_event = set_timer_sec(CACHE_TIMEOUT);
+    entry->refresh = set_timer_sec(CACHE_TIMEOUT - REFRESH_BEFORE);
 }
 
 static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
@@ -91,8 +147,8 @@ static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
 
     if(packet->arp->hardware_type   == htons(HARDWARE_TYPE_ETHERNET) && 
        packet->arp->protocol_type   == htons(PROTOCOL_TYPE_IPV4) &&
-       packet->arp->hardware_length == htons(sizeof(macaddr_t)) && 
-       packet->arp->protocol_length == htons(sizeof(uint32_t))){
+       packet->arp->hardware_length == sizeof(macaddr_t) &&
+       packet->arp->protocol_length == sizeof(uint32_t)){
         switch(ntohs(packet->arp->operation)){
             case arp_op_request: // who has <ip>?
 #ifdef ARP_DEBUG
@@ -105,7 +161,7 @@ static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
 #endif
                     // this was for us; generate an ARP reply
                     packet_t *reply = packet_create_arp();
-                    reply->arp->operation = arp_op_reply;
+                    reply->arp->operation = htons(arp_op_reply);
                     reply->arp->target_ip = packet->arp->sender_ip;
                     memcpy(reply->arp->target_mac, packet->arp->sender_mac, sizeof(macaddr_t));
                     packet_set_destination_mac(reply, &reply->arp->target_mac);
@@ -135,32 +191,23 @@ static void arp_process_packet(packet_sink_t *sink, packet_t *packet)
 
 static void arp_cache_flush(packet_sink_t *sink)
 {
+    arp_cache_entry_t *entry = &arp_cache[0][0];
     int total = 0, expired = 0;
 
-    arp_cache_entry_t *entry = cache_list_head, *next;
-    arp_cache_entry_t **entry_ptr = &cache_list_head;
-
     sink->timer = set_timer_sec(CACHE_FLUSH_INTERVAL);
 
-    while(entry){
+    for(int i=0; i<ARP_BUCKETS*ARP_WAYS; i++, entry++){
+        if(!entry->ipv4_address)
+            continue;
         total++;
-        if((entry->valid && timer_expired(entry->next_event)) || // valid but timed out
-           (!entry->valid && entry->resolve_attempts >= MAX_RESOLVE_ATTEMPTS)){ // resolve failed
-            // dead -- remove entry
+        if(arp_entry_dead(entry)){
+            // dead -- free entry
 #ifdef ARP_DEBUG
             printf("arp: flushing %svalid entry for ip 0x%08lx\n", 
                     entry->valid ? "":"in", entry->ipv4_address);
 #endif
             expired++;
-            next = entry->next; // stash this now, before we free this entry
-            *entry_ptr = entry->next;
-            free(entry);
-            entry = next;
-            // do not update entry_ptr
-        }else{
-            // walk list
-            entry_ptr = &entry->next;
-            entry = entry->next;
+            entry->ipv4_address = 0;
         }
     }
 
@@ -175,7 +222,7 @@ static void arp_transmit_query(arp_cache_entry_t *entry)
     entry->next_event = set_timer_ms(QUERY_INTERVAL);
 
     packet_t *query = packet_create_arp();
-    query->arp->operation = arp_op_request;
+    query->arp->operation = htons(arp_op_request);
     query->arp->target_ip = htonl(entry->ipv4_address);
     memset(query->arp->target_mac, 0, sizeof(macaddr_t));
     packet_set_destination_mac(query, &broadcast_macaddr);
@@ -186,9 +233,23 @@ static void arp_transmit_query(arp_cache_entry_t *entry)
     net_tx(query);
 }
 
+// ask the peer directly whether its entry still holds, while we go on using it
+static void arp_transmit_refresh(arp_cache_entry_t *entry)
+{
+    entry->refresh = set_timer_ms(REFRESH_INTERVAL);
+    arp_refresh_count++;
+
+    packet_t *query = packet_create_arp();
+    query->arp->operation = htons(arp_op_request);
+    query->arp->target_ip = htonl(entry->ipv4_address);
+    memset(query->arp->target_mac, 0, sizeof(macaddr_t));
+    packet_set_destination_mac(query, &entry->mac_address);
+    net_tx(query);
+}
+
 arp_result_t net_arp_resolve(packet_t *packet)
 {
-    arp_cache_entry_t *entry = cache_list_head;
+    arp_cache_entry_t *entry;
 
     // no ARP required for broadcast
     if(packet->ipv4 && (
@@ -198,43 +259,85 @@ arp_result_t net_arp_resolve(packet_t *packet)
         return arp_okay;
     }
 
-    while(entry){
-        if(entry->ipv4_address == packet->ipv4_nexthop)
-            break;
-        entry = entry->next;
+    // nor for multicast, which maps straight onto a MAC address
+    if(packet->ipv4 && net_ipv4_is_multicast(ntohl(packet->ipv4->destination_ip))){
+        macaddr_t mac;
+        net_multicast_macaddr(ntohl(packet->ipv4->destination_ip), mac);
+        packet_set_destination_mac(packet, &mac);
+        return arp_okay;
     }
 
+    // no route: off our subnet with no gateway
+    if(packet->ipv4_nexthop == 0)
+        return arp_fail;
+
+    entry = arp_cache_lookup(packet->ipv4_nexthop);
+
     if(!entry){
         // allocate a new entry and begin resolution
-        entry = malloc(sizeof(arp_cache_entry_t));
-        memset(entry->mac_address, 0, sizeof(macaddr_t));
-        entry->next = cache_list_head;
-        cache_list_head = entry;
-        entry->ipv4_address = packet->ipv4_nexthop;
+        entry = arp_cache_allocate(packet->ipv4_nexthop);
+        arp_transmit_query(entry);
+    }else if(entry->valid){
+        entry->last_used = gogoboot_read_timer();
+        if(!timer_expired(entry->next_event)){
+            if(timer_expired(entry->refresh))
+                arp_transmit_refresh(entry);
+            packet_set_destination_mac(packet, &entry->mac_address);
+            arp_hit_count++;
+            return arp_okay;
+        }
+        // it expired despite the refresh queries; start again
         entry->valid = false;
+        entry->stale = true;
         entry->resolve_attempts = 0;
         arp_transmit_query(entry);
-        return arp_wait;
-    }
-
-    if(entry->valid){
-        packet_set_destination_mac(packet, &entry->mac_address);
-        return arp_okay;
-    }
-
-    if(timer_expired(entry->next_event)){
+    }else if(timer_expired(entry->next_event)){
         if(entry->resolve_attempts >= MAX_RESOLVE_ATTEMPTS){
             return arp_fail;
         }
         arp_transmit_query(entry);
     }
 
+    // count each packet that has to wait once
+    if(!(packet->flags & packet_flag_arp_wait)){
+        packet->flags |= packet_flag_arp_wait;
+        arp_miss_count++;
+        if(entry->stale)
+            arp_stall_count++;
+    }
+
     return arp_wait;
 }
 
+void net_arp_dump_cache(void) // used by "netinfo" command
+{
+    arp_cache_entry_t *entry = &arp_cache[0][0];
+    timer_t now = gogoboot_read_timer();
+
+    printf("arp: %ld hits, %ld misses, %ld stalls, %ld refreshes\n",
+            arp_hit_count, arp_miss_count, arp_stall_count, arp_refresh_count);
+
+    for(int i=0; i<ARP_BUCKETS*ARP_WAYS; i++, entry++){
+        if(!entry->ipv4_address)
+            continue;
+        printf("  %d.%d.%d.%d ",
+                (int)(entry->ipv4_address >> 24 & 0xff),
+                (int)(entry->ipv4_address >> 16 & 0xff),
+                (int)(entry->ipv4_address >>  8 & 0xff),
+                (int)(entry->ipv4_address       & 0xff));
+        if(entry->valid)
+            printf("%02x:%02x:%02x:%02x:%02x:%02x expires %lds\n",
+                    entry->mac_address[0], entry->mac_address[1], entry->mac_address[2],
+                    entry->mac_address[3], entry->mac_address[4], entry->mac_address[5],
+                    (long)(entry->next_event - now) / TIMER_HZ);
+        else
+            printf("resolving, %d queries\n", entry->resolve_attempts);
+    }
+}
+
 void net_arp_init(void)
 {
-    cache_list_head = NULL;
+    memset(arp_cache, 0, sizeof(arp_cache));
     sink = packet_sink_alloc();
     sink->match_ethertype = ethertype_arp;
     sink->cb_packet_received = arp_process_packet;
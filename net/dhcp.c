@@ -18,6 +18,8 @@ static uint32_t dhcp_offer_subnet_mask;
 static uint32_t dhcp_offer_gateway;
 static uint32_t dhcp_offer_dns_server;
 static uint32_t dhcp_offer_lease_time;
+static uint32_t dhcp_offer_boot_server;
+static char dhcp_offer_boot_file[DHCP_BOOT_FILE_MAX];
 int renew_retry_remaining;
 
 static dhcp_state_t dhcp_state;
@@ -27,8 +29,9 @@ static packet_sink_t *sink;
 uint8_t const discover_options[] = {
     // DHCP message type - DHCPDISCOVER
     dhcp_opt_message_type,  0x01, dhcp_type_discover,
-    // DHCP parameter request list (1=subnet mask, 3=router, 6=nameserver, 15=domain name)
-    dhcp_opt_param_request, 0x04, 0x01, 0x03, 0x06, 0x0f,
+    // DHCP parameter request list (1=subnet mask, 3=router, 6=nameserver, 15=domain name,
+    // 66=TFTP server name, 67=bootfile name)
+    dhcp_opt_param_request, 0x06, 0x01, 0x03, 0x06, 0x0f, 0x42, 0x43,
 };
 
 uint8_t const dhcp_always_options[] = {
@@ -105,10 +108,20 @@ static void dhcp_send_request(void)
     net_tx(req);
 }
 
+// copy a boot file name from the BOOTP file field or option 67; neither need be terminated
+static void dhcp_copy_boot_file(const uint8_t *name, int len)
+{
+    if(len >= DHCP_BOOT_FILE_MAX)
+        len = DHCP_BOOT_FILE_MAX-1;
+    memcpy(dhcp_offer_boot_file, name, len);
+    dhcp_offer_boot_file[len] = 0;
+}
+
 bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
 {
     int offset, length;
-    uint8_t opt_code, opt_len, *opt_data;
+    uint8_t opt_code, opt_len, *opt_data, *file_end;
+    char server_name[16];
     dhcp_message_t *d = (dhcp_message_t*)packet->data;
 
 #ifdef DHCP_DEBUG
@@ -142,6 +155,11 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
     dhcp_offer_dns_server = 0;
     dhcp_offer_ipv4_address = ntohl(d->yiaddr);
 
+    // BOOTP fields; options 66 and 67 below take precedence
+    dhcp_offer_boot_server = ntohl(d->siaddr);
+    file_end = memchr(d->file, 0, sizeof(d->file));
+    dhcp_copy_boot_file(d->file, file_end ? file_end - d->file : sizeof(d->file));
+
     // process DHCP options
     while(offset < length){
         if(d->options[offset] == dhcp_opt_terminator) // END option
@@ -193,6 +211,18 @@ bool process_dhcp_reply(packet_t *packet, uint8_t expected_dhcp_type)
                         return false;
                     dhcp_offer_dns_server = ntohl(*((uint32_t*)opt_data));
                     break;
+                case dhcp_opt_tftp_server:
+                    // a host name, but we have no resolver; use it only if it is an address
+                    if(opt_len > 0 && opt_len < sizeof(server_name)){
+                        memcpy(server_name, opt_data, opt_len);
+                        server_name[opt_len] = 0;
+                        if(net_parse_ipv4(server_name))
+                            dhcp_offer_boot_server = net_parse_ipv4(server_name);
+                    }
+                    break;
+                case dhcp_opt_bootfile:
+                    dhcp_copy_boot_file(opt_data, opt_len);
+                    break;
                 default:
                     break;
             }
@@ -228,6 +258,8 @@ static void dhcp_enter_state(dhcp_state_t state)
             interface_ipv4_gateway = 0;
             interface_ipv4_address = 0;
             interface_subnet_mask = 0;
+            interface_boot_server = 0;
+            interface_boot_file[0] = 0;
             // create and send a DHCPDISCOVER message
             net_tx(packet_create_dhcp(ipv4_broadcast, dhcp_type_discover,
                         discover_options, sizeof(discover_options)));
@@ -322,6 +354,8 @@ static void dhcp_pump(packet_sink_t *s, packet_t *packet)
                 interface_subnet_mask = mask = dhcp_offer_subnet_mask;
                 interface_ipv4_gateway = dhcp_offer_gateway;
                 interface_dns_server = dhcp_offer_dns_server;
+                interface_boot_server = dhcp_offer_boot_server;
+                strcpy(interface_boot_file, dhcp_offer_boot_file);
                 while(mask){
                     prefixlen++;
                     mask <<= 1;
@@ -335,6 +369,12 @@ static void dhcp_pump(packet_sink_t *s, packet_t *packet)
                             prefixlen,
                             (int)(dhcp_offer_lease_time / 3600),
                             (int)(dhcp_offer_lease_time % 3600)/60);
+                    if(interface_boot_file[0] && interface_boot_server)
+                        printf("DHCP boot file \"%s\" on %d.%d.%d.%d\n", interface_boot_file,
+                                (int)(interface_boot_server >> 24 & 0xff),
+                                (int)(interface_boot_server >> 16 & 0xff),
+                                (int)(interface_boot_server >>  8 & 0xff),
+                                (int)(interface_boot_server       & 0xff));
                 }
                 dhcp_enter_state(DHCP_BOUND);
             }
@@ -343,6 +383,11 @@ static void dhcp_pump(packet_sink_t *s, packet_t *packet)
     packet_free(packet);
 }
 
+bool dhcp_enabled(void)
+{
+    return sink != NULL;
+}
+
 void dhcp_init(void)
 {
     sink = packet_sink_alloc();
@@ -44,6 +44,8 @@ static const uint8_t dhcp_opt_message_type  = 0x35;
 static const uint8_t dhcp_opt_server_id     = 0x36;
 static const uint8_t dhcp_opt_param_request = 0x37;
 static const uint8_t dhcp_opt_max_size      = 0x39;
+static const uint8_t dhcp_opt_tftp_server   = 0x42;
+static const uint8_t dhcp_opt_bootfile      = 0x43;
 static const uint8_t dhcp_opt_terminator    = 0xff;
 
 static const uint8_t dhcp_type_discover = 1;
@@ -0,0 +1,583 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <uart.h>
+#include <timers.h>
+#include <fatfs/ff.h>
+#include <cli.h>
+#include <net.h>
+
+// documentation:
+// https://www.rfc-editor.org/rfc/rfc9110 - HTTP Semantics (including range requests)
+// https://www.rfc-editor.org/rfc/rfc9112 - HTTP/1.1
+
+// A minimal HTTP/1.1 client for fetching files. We only send GET, and only
+// understand responses framed by Content-Length (or by the server closing
+// the connection). The connection is kept open after a transfer so the next
+// request to the same server can reuse it. If the connection drops part way
+// through, we reconnect and ask for the remainder with a Range request.
+
+#define HTTP_DEFAULT_PORT       80
+#define HTTP_CONNECT_TIMEOUT 10000 // ms
+#define HTTP_IDLE_TIMEOUT    15000 // ms without any data before we give up on the connection
+#define HTTP_CLOSE_TIMEOUT    1000 // ms we wait for the server to finish closing the connection
+#define HTTP_MAX_RESUMES         4 // times we reconnect and resume one transfer
+#define HTTP_MAX_LINE          256 // longest header line we keep; longer lines are truncated
+#define HTTP_MAX_REQUEST       512
+#define HTTP_WRITE_BUFFER       32 // KB, default size of the write coalescing buffer for disk
+
+typedef enum {
+    http_state_idle,        // no request outstanding
+    http_state_status,      // reading the status line
+    http_state_headers,
+    http_state_body,
+    http_state_done,
+    http_state_failed,
+} http_state_t;
+
+typedef struct http_transfer_t http_transfer_t;
+
+struct http_transfer_t {
+    // request
+    uint32_t server_ip;
+    uint16_t server_port;
+    const char *path;
+    uint32_t offset;          // bytes we already have; we ask for the rest
+
+    // response
+    http_state_t state;
+    int status;
+    bool keep_alive;          // server will keep the connection open after this response
+    bool have_length;
+    uint32_t content_length;
+    uint32_t range_start;     // from Content-Range
+    uint32_t total_size;      // whole file, 0 if unknown
+    uint32_t body_received;   // bytes of this response's body received so far
+    char line[HTTP_MAX_LINE];
+    int line_length;
+    timer_t last_data;
+
+    // destination
+    http_data_cb_t data_cb;   // when set, received data is passed here instead of written to disk_file
+    void *data_cb_private;
+    FIL disk_file;
+    char *disk_filename;
+    write_buffer_t write_buffer; // received data is collected here and written to disk_file in whole clusters
+};
+
+// kept open between transfers
+static tcp_connection_t *http_connection;
+static uint32_t http_connection_ip;
+static uint16_t http_connection_port;
+static http_transfer_t *http_current; // the transfer using http_connection, or NULL
+
+static void http_drop_connection(void)
+{
+    timer_t timeout;
+
+    if(http_connection){
+        if(tcp_established(http_connection)){
+            // be polite; tcp_free() resets a connection that is still closing
+            tcp_close(http_connection);
+            timeout = set_timer_ms(HTTP_CLOSE_TIMEOUT);
+            while(!tcp_closed(http_connection) && !timer_expired(timeout))
+                net_pump();
+        }
+        tcp_free(http_connection);
+        http_connection = NULL;
+    }
+}
+
+static bool http_parse_url(const char *url, uint32_t *ip, uint16_t *port, const char **path)
+{
+    const char *host, *p;
+    char hostname[16];
+    int len;
+    uint32_t n;
+
+    if(strncasecmp(url, "http://", 7) == 0)
+        url += 7;
+    else if(strchr(url, ':') && strncmp(strchr(url, ':'), "://", 3) == 0){
+        printf("http: only http:// URLs are supported\n");
+        return false;
+    }
+
+    host = url;
+    for(p = host; *p && *p != ':' && *p != '/'; p++);
+    len = p - host;
+    if(len == 0 || len >= sizeof(hostname)){
+        printf("http: bad host in URL \"%s\"\n", url);
+        return false;
+    }
+    memcpy(hostname, host, len);
+    hostname[len] = 0;
+
+    *ip = net_parse_ipv4(hostname);
+    if(*ip == 0){
+        printf("http: cannot parse server IPv4 address \"%s\" (host names are not supported)\n", hostname);
+        return false;
+    }
+
+    *port = HTTP_DEFAULT_PORT;
+    if(*p == ':'){
+        n = strtoul(p+1, &p, 10);
+        if(n == 0 || n > 65535 || (*p && *p != '/')){
+            printf("http: bad port in URL\n");
+            return false;
+        }
+        *port = n;
+    }
+
+    *path = *p ? p : "/";
+    return true;
+}
+
+static void http_append(char *buffer, const char *text)
+{
+    if(strlen(buffer) + strlen(text) < HTTP_MAX_REQUEST)
+        strcat(buffer, text);
+}
+
+static void http_append_int(char *buffer, uint32_t n)
+{
+    char digits[12];
+    char *t = digits+sizeof(digits);
+
+    *--t = 0;
+    do {
+        *--t = (n % 10)+'0';
+        n/=10;
+    } while(n);
+
+    http_append(buffer, t);
+}
+
+static bool http_header_is(const char *line, const char *name, const char **value)
+{
+    int len = strlen(name);
+
+    if(strncasecmp(line, name, len) != 0 || line[len] != ':')
+        return false;
+    for(line += len+1; *line == ' ' || *line == '\t'; line++);
+    *value = line;
+    return true;
+}
+
+static void http_fail(http_transfer_t *http, const char *message)
+{
+    if(message)
+        printf("http: %s\n", message);
+    http->state = http_state_failed;
+}
+
+static void http_process_line(http_transfer_t *http)
+{
+    const char *value;
+    const char *p;
+
+    if(http->state == http_state_status){
+        // HTTP/1.x nnn reason
+        if(strncmp(http->line, "HTTP/1.", 7) != 0 || http->line[8] != ' '){
+            http_fail(http, "bad response from server");
+            return;
+        }
+        http->status = strtoul(http->line + 9, NULL, 10);
+        http->keep_alive = (http->line[7] != '0'); // HTTP/1.0 closes by default
+        http->state = http_state_headers;
+        return;
+    }
+
+    if(http->line_length == 0){
+        // end of the headers
+        if(http->status != 200 && http->status != 206){
+            printf("http: server replied with status %d\n", http->status);
+            http->keep_alive = false;
+            http->state = http_state_failed;
+            return;
+        }
+        if(http->status == 200 && http->offset){
+            http_fail(http, "server does not support ranges; cannot resume");
+            http->keep_alive = false;
+            return;
+        }
+        if(http->status == 206 && http->range_start != http->offset){
+            http_fail(http, "server returned the wrong range");
+            http->keep_alive = false;
+            return;
+        }
+        if(http->status == 200)
+            http->total_size = http->have_length ? http->content_length : 0;
+        if(!http->have_length)
+            http->keep_alive = false; // body runs until the server closes
+        http->state = (http->have_length && http->content_length == 0) ? http_state_done : http_state_body;
+        return;
+    }
+
+    if(http_header_is(http->line, "Content-Length", &value)){
+        http->content_length = strtoul(value, NULL, 10);
+        http->have_length = true;
+    }else if(http_header_is(http->line, "Content-Range", &value)){
+        // bytes first-last/total
+        if(strncasecmp(value, "bytes ", 6) == 0){
+            http->range_start = strtoul(value + 6, &p, 10);
+            p = strchr(p, '/');
+            if(p && p[1] != '*')
+                http->total_size = strtoul(p + 1, NULL, 10);
+        }
+    }else if(http_header_is(http->line, "Connection", &value)){
+        if(strncasecmp(value, "close", 5) == 0)
+            http->keep_alive = false;
+        else if(strncasecmp(value, "keep-alive", 10) == 0)
+            http->keep_alive = true;
+    }else if(http_header_is(http->line, "Transfer-Encoding", &value)){
+        if(strncasecmp(value, "identity", 8) != 0){
+            http_fail(http, "chunked transfer encoding is not supported");
+            http->keep_alive = false;
+        }
+    }
+}
+
+static bool http_write_data(http_transfer_t *http, const void *data, int size)
+{
+    if(http->data_cb)
+        return http->data_cb(http->data_cb_private, http->offset, data, size, http->total_size);
+    return write_buffer_write(&http->write_buffer, data, size);
+}
+
+// called by tcp.c from within net_pump() with each run of in-order data
+static bool http_data_received(void *cb_private, const void *data, int length)
+{
+    http_transfer_t *http = http_current;
+    const char *src = data;
+    int chunk;
+
+    (void)cb_private;
+
+    if(!http || http->state == http_state_idle || http->state == http_state_done || http->state == http_state_failed)
+        return false; // nothing expected; drop the connection
+
+    http->last_data = gogoboot_read_timer();
+
+    while(length){
+        if(http->state == http_state_status || http->state == http_state_headers){
+            if(*src == '\n'){
+                if(http->line_length && http->line[http->line_length-1] == '\r')
+                    http->line_length--;
+                http->line[http->line_length] = 0;
+                http_process_line(http);
+                http->line_length = 0;
+            }else if(http->line_length < HTTP_MAX_LINE-1)
+                http->line[http->line_length++] = *src;
+            src++;
+            length--;
+        }else if(http->state == http_state_body){
+            chunk = length;
+            if(http->have_length && chunk > http->content_length - http->body_received)
+                chunk = http->content_length - http->body_received;
+            if(!http_write_data(http, src, chunk)){
+                http->state = http_state_failed;
+                return false;
+            }
+            http->offset += chunk;
+            http->body_received += chunk;
+            src += chunk;
+            length -= chunk;
+            if(http->have_length && http->body_received == http->content_length){
+                http->state = http_state_done;
+                if(length) // we never pipeline, so there should be nothing more
+                    http->keep_alive = false;
+                break;
+            }
+        }else
+            break;
+    }
+
+    return http->state != http_state_failed;
+}
+
+static bool http_connect(http_transfer_t *http)
+{
+    timer_t timeout;
+
+    if(http_connection && (http_connection_ip != http->server_ip || http_connection_port != http->server_port ||
+                           !tcp_established(http_connection) || tcp_remote_closed(http_connection)))
+        http_drop_connection();
+
+    if(http_connection)
+        return true; // reuse
+
+    http_connection = tcp_connect(http->server_ip, http->server_port, http_data_received, NULL);
+    if(!http_connection)
+        return false;
+    http_connection_ip = http->server_ip;
+    http_connection_port = http->server_port;
+
+    timeout = set_timer_ms(HTTP_CONNECT_TIMEOUT);
+    while(!tcp_established(http_connection)){
+        net_pump();
+        if(tcp_closed(http_connection) || timer_expired(timeout)){
+            printf("http: %s\n", tcp_error(http_connection) ? tcp_error(http_connection) : "connection timed out");
+            http_drop_connection();
+            return false;
+        }
+        if(uart_check_cancel_key()){
+            printf("Aborted.\n");
+            http_drop_connection();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool http_send_request(http_transfer_t *http)
+{
+    char *request = malloc(HTTP_MAX_REQUEST);
+    uint32_t ip = http->server_ip;
+    int length, sent;
+
+    request[0] = 0;
+    http_append(request, "GET ");
+    http_append(request, http->path);
+    http_append(request, " HTTP/1.1\r\nHost: ");
+    http_append_int(request, ip >> 24 & 0xff);
+    http_append(request, ".");
+    http_append_int(request, ip >> 16 & 0xff);
+    http_append(request, ".");
+    http_append_int(request, ip >> 8 & 0xff);
+    http_append(request, ".");
+    http_append_int(request, ip & 0xff);
+    if(http->server_port != HTTP_DEFAULT_PORT){
+        http_append(request, ":");
+        http_append_int(request, http->server_port);
+    }
+    http_append(request, "\r\nUser-Agent: gogoboot\r\nConnection: keep-alive\r\n");
+    if(http->offset){
+        http_append(request, "Range: bytes=");
+        http_append_int(request, http->offset);
+        http_append(request, "-\r\n");
+    }
+    http_append(request, "\r\n");
+
+    length = strlen(request);
+    sent = tcp_send(http_connection, request, length);
+    free(request);
+
+    if(sent != length){
+        printf("http: cannot send request\n");
+        return false;
+    }
+    return true;
+}
+
+// run one GET on the current connection until the response completes or fails
+static bool http_request(http_transfer_t *http)
+{
+    int uart_byte;
+    uint32_t reported = http->offset;
+
+    http->state = http_state_status;
+    http->status = 0;
+    http->keep_alive = false;
+    http->have_length = false;
+    http->content_length = 0;
+    http->range_start = 0;
+    http->body_received = 0;
+    http->line_length = 0;
+    http->last_data = gogoboot_read_timer();
+    http_current = http;
+
+    if(!http_send_request(http))
+        http->state = http_state_failed;
+
+    while(http->state != http_state_done && http->state != http_state_failed){
+        net_pump();
+        if(tcp_remote_closed(http_connection)){
+            // the server closed; that ends the body only if it had no length
+            if(http->state == http_state_body && !http->have_length)
+                http->state = http_state_done;
+            else
+                break;
+        }
+        if(timer_expired(http->last_data + (HTTP_IDLE_TIMEOUT / TIMER_MS_PER_TICK))){
+            printf("http: connection stalled\n");
+            break;
+        }
+        uart_byte = uart_read_byte();
+        if(uart_byte == 'q' || uart_byte == 'Q'){
+            printf("Aborted.\n");
+            http->state = http_state_failed;
+            http->keep_alive = false;
+            break;
+        }
+        if(http->offset - reported >= 256*1024){
+            reported = http->offset;
+            if(http->total_size)
+                printf("http: %ld/%ld KB\n", reported >> 10, http->total_size >> 10);
+            else
+                printf("http: %ld KB\n", reported >> 10);
+        }
+    }
+
+    http_current = NULL;
+
+    if(http->state == http_state_done && !http->keep_alive)
+        http_drop_connection();
+
+    return http->state == http_state_done;
+}
+
+static bool http_run(http_transfer_t *http)
+{
+    uint32_t start, taken, rate, first_offset = http->offset;
+    int resumes = 0;
+    bool reused;
+
+    printf("Transfer started: Press Q to abort\n");
+    start = gogoboot_read_timer();
+
+    while(true){
+        reused = (http_connection != NULL);
+        if(!http_connect(http))
+            break;
+        if(http_request(http))
+            break;
+        if(http->state == http_state_failed)
+            break; // the server or our destination refused; retrying will not help
+        http_drop_connection();
+        // the connection dropped; pick up where we left off. A kept-alive
+        // connection may simply have been closed by the server while idle.
+        if(!reused || http->body_received){
+            if(++resumes > HTTP_MAX_RESUMES){
+                printf("http: too many retries\n");
+                break;
+            }
+        }
+        if(http->offset)
+            printf("http: connection lost, resuming at %ld bytes\n", http->offset);
+    }
+
+    if(http->state != http_state_done){
+        http_drop_connection();
+        printf("Transfer FAILED!\n");
+        return false;
+    }
+
+    printf("Transfer success.\n");
+    taken = gogoboot_read_timer() - start;
+    taken /= (TIMER_HZ/10); // taken is now in 10ths of a second
+    if(taken == 0)
+        taken = 1; // avoid div 0
+    rate = (((http->offset - first_offset) / taken)*8) / 1000;
+    printf("Transferred %ld bytes in %ld.%lds (%ld.%02ld Mbit/sec)%s\n",
+            http->offset - first_offset, taken/10, taken%10, rate/100, rate%100,
+            resumes ? " with resumes" : "");
+    return true;
+}
+
+static http_transfer_t *http_alloc(const char *url)
+{
+    http_transfer_t *http = malloc(sizeof(http_transfer_t));
+
+    memset(http, 0, sizeof(http_transfer_t));
+    if(!http_parse_url(url, &http->server_ip, &http->server_port, &http->path)){
+        free(http);
+        return NULL;
+    }
+    return http;
+}
+
+static void http_free(http_transfer_t *http)
+{
+    free(http->disk_filename);
+    write_buffer_free(&http->write_buffer);
+    free(http);
+}
+
+bool http_transfer(const char *url, const char *disk_filename, bool resume)
+{
+    FRESULT fr;
+    bool success = false;
+    http_transfer_t *http = http_alloc(url);
+
+    if(!http)
+        return false;
+
+    http->disk_filename = strdup(disk_filename);
+    fr = f_open(&http->disk_file, http->disk_filename, resume ? (FA_WRITE | FA_OPEN_APPEND) : (FA_WRITE | FA_CREATE_ALWAYS));
+    if(fr != FR_OK){
+        printf("http: failed to open \"%s\": %s\n", http->disk_filename, f_errmsg(fr));
+    }else{
+        http->offset = f_size(&http->disk_file);
+        write_buffer_init(&http->write_buffer, "http", &http->disk_file, http->disk_filename, HTTP_WRITE_BUFFER);
+
+        printf("http: get %s to file \"%s\"", url, http->disk_filename);
+        if(http->offset)
+            printf(" from offset %ld", http->offset);
+        putchar('\n');
+
+        success = http_run(http);
+        if(!write_buffer_flush(&http->write_buffer))
+            success = false;
+        f_close(&http->disk_file);
+    }
+
+    http_free(http);
+    return success;
+}
+
+bool http_receive(const char *url, http_data_cb_t data_cb, void *data_cb_private)
+{
+    bool success;
+    http_transfer_t *http = http_alloc(url);
+
+    if(!http)
+        return false;
+
+    http->data_cb = data_cb;
+    http->data_cb_private = data_cb_private;
+
+    printf("http: get %s\n", url);
+    success = http_run(http);
+
+    http_free(http);
+    return success;
+}
+
+typedef struct {
+    uint32_t load_address;
+    uint32_t load_size;
+} http_memory_target_t;
+
+static bool http_memory_write(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size)
+{
+    http_memory_target_t *target = cb_private;
+
+    // check the whole range up front when we know the size
+    if(offset == 0 && total_size && !load_reserve(target->load_address, total_size))
+        return false;
+
+    if(!load_data_buffer(target->load_address + offset, data, length))
+        return false;
+
+    target->load_size = offset + length;
+    return true;
+}
+
+bool http_load(const char *url, uint32_t load_address, uint32_t *load_size)
+{
+    http_memory_target_t target;
+    bool success;
+
+    target.load_address = load_address;
+    target.load_size = 0;
+
+    printf("http: loading to memory at 0x%lx\n", load_address);
+    success = http_receive(url, http_memory_write, &target);
+
+    if(load_size)
+        *load_size = target.load_size;
+
+    return success;
+}
@@ -0,0 +1,139 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <cli.h>
+#include <net.h>
+
+// documentation:
+// https://www.rfc-editor.org/rfc/rfc1112 - Host Extensions for IP Multicasting
+// https://www.rfc-editor.org/rfc/rfc2236 - Internet Group Management Protocol, Version 2
+
+// Multicast group membership. Joining a group programs the ethernet card's
+// multicast filter and announces us with an IGMPv2 report so that switches
+// which snoop IGMP forward the group's traffic to our port. While we are a
+// member of any group we also answer the router's membership queries.
+
+#define MAX_GROUPS 4
+
+static uint32_t igmp_groups[MAX_GROUPS];
+static int igmp_group_count = 0;
+static packet_sink_t *igmp_sink = NULL;
+
+static const uint32_t igmp_all_hosts   = 0xe0000001; // 224.0.0.1
+static const uint32_t igmp_all_routers = 0xe0000002; // 224.0.0.2
+
+void net_multicast_macaddr(uint32_t group, macaddr_t mac)
+{
+    // 01:00:5e followed by the low 23 bits of the group address
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = (group >> 16) & 0x7f;
+    mac[4] = (group >> 8) & 0xff;
+    mac[5] = group & 0xff;
+}
+
+static void igmp_update_filter(void)
+{
+    macaddr_t list[MAX_GROUPS+1];
+    int i;
+
+    for(i=0; i<igmp_group_count; i++)
+        net_multicast_macaddr(igmp_groups[i], list[i]);
+    // queries go to all-hosts
+    if(igmp_group_count)
+        net_multicast_macaddr(igmp_all_hosts, list[i++]);
+
+    eth_set_multicast_list(list, i);
+}
+
+static void igmp_send(uint8_t type, uint32_t group, uint32_t destination)
+{
+    packet_t *packet;
+    igmp_header_t *igmp;
+
+    if(!interface_ipv4_address)
+        return;
+
+    packet = packet_create_igmp(destination, sizeof(igmp_header_t));
+    igmp = (igmp_header_t*)packet->data;
+    igmp->type = type;
+    igmp->max_response_time = 0;
+    igmp->group = htonl(group);
+    igmp->checksum = 0;
+    igmp->checksum = ~net_checksum_fold(net_checksum_update(0, igmp, sizeof(igmp_header_t)));
+
+    net_tx(packet);
+}
+
+static void igmp_received(packet_sink_t *sink, packet_t *packet)
+{
+    igmp_header_t *igmp = (igmp_header_t*)packet->data;
+    uint32_t group;
+    int i;
+
+    if(packet->data_length >= sizeof(igmp_header_t) && igmp->type == igmp_type_query){
+        // a general query (group 0) asks about every group we are in;
+        // we answer at once rather than after a random delay
+        group = ntohl(igmp->group);
+        for(i=0; i<igmp_group_count; i++)
+            if(group == 0 || group == igmp_groups[i])
+                igmp_send(igmp_type_v2_report, igmp_groups[i], igmp_groups[i]);
+    }
+
+    packet_free(packet);
+}
+
+bool net_multicast_join(uint32_t group)
+{
+    int i;
+
+    if(!net_ipv4_is_multicast(group))
+        return false;
+
+    for(i=0; i<igmp_group_count; i++)
+        if(igmp_groups[i] == group)
+            return true;
+
+    if(igmp_group_count == MAX_GROUPS){
+        printf("igmp: too many multicast groups\n");
+        return false;
+    }
+
+    if(!igmp_sink){
+        igmp_sink = packet_sink_alloc();
+        igmp_sink->match_ethertype = ethertype_ipv4;
+        igmp_sink->match_ipv4_protocol = ip_proto_igmp;
+        igmp_sink->cb_packet_received = igmp_received;
+        net_add_packet_sink(igmp_sink);
+    }
+
+    igmp_groups[igmp_group_count++] = group;
+    igmp_update_filter();
+    igmp_send(igmp_type_v2_report, group, group);
+
+    return true;
+}
+
+void net_multicast_leave(uint32_t group)
+{
+    int i;
+
+    for(i=0; i<igmp_group_count; i++)
+        if(igmp_groups[i] == group)
+            break;
+    if(i == igmp_group_count)
+        return;
+
+    igmp_groups[i] = igmp_groups[--igmp_group_count];
+    igmp_update_filter();
+    igmp_send(igmp_type_v2_leave, group, igmp_all_routers);
+
+    if(igmp_group_count == 0 && igmp_sink){
+        net_remove_packet_sink(igmp_sink);
+        packet_sink_free(igmp_sink);
+        igmp_sink = NULL;
+    }
+}
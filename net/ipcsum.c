@@ -6,8 +6,13 @@
 #include <cli.h>
 #include <net.h>
 
-static uint32_t checksum_update(uint32_t sum, uint16_t *addr, unsigned int count)
+/* Portable reference implementation; the ROM uses net_checksum_update() from
+ * ipcsum68k.s, this one is kept for the cksumbench command to compare
+ * against. */
+uint32_t net_checksum_update_c(uint32_t sum, const void *data, unsigned int count)
 {
+    const uint16_t *addr = data;
+
     // sum words
     while(count >= 2){
         sum += *(addr++);
@@ -22,6 +27,11 @@ static uint32_t checksum_update(uint32_t sum, uint16_t *addr, unsigned int count
     return sum;
 }
 
+static inline uint32_t checksum_update(uint32_t sum, uint16_t *addr, unsigned int count)
+{
+    return net_checksum_update(sum, addr, count);
+}
+
 static uint16_t checksum_complete(uint32_t sum)
 {
     // Fold sum to 16 bits: add carrier to result
@@ -32,6 +42,11 @@ static uint16_t checksum_complete(uint32_t sum)
     return ((unsigned short)~sum);
 }
 
+uint16_t net_checksum_fold(uint32_t sum)
+{
+    return ~checksum_complete(sum);
+}
+
 static uint16_t checksum_compute(uint16_t *addr, unsigned int count) 
 {
     return checksum_complete(checksum_update(0, addr, count));
@@ -40,62 +55,132 @@ static uint16_t checksum_compute(uint16_t *addr, unsigned int count)
 void net_compute_ipv4_checksum(packet_t *packet)
 {
     packet->ipv4->checksum = 0; // set to zero for checksum computation
-    packet->ipv4->checksum = htons(checksum_compute((uint16_t*)packet->ipv4, 
-                sizeof(ipv4_header_t)));
+    packet->ipv4->checksum = checksum_compute((uint16_t*)packet->ipv4,
+                sizeof(ipv4_header_t));
 }
 
 bool net_verify_ipv4_checksum(packet_t *packet)
 {
-    return (checksum_compute((uint16_t*)packet->ipv4, sizeof(ipv4_header_t)) == 0);
+    // the sum covers any options too (eg Router Alert on IGMP queries)
+    return (checksum_compute((uint16_t*)packet->ipv4, (packet->ipv4->version_length & 0xf) << 2) == 0);
 }
 
 void net_compute_icmp_checksum(packet_t *packet)
 {
     packet->icmp->checksum = 0;
-    packet->icmp->checksum = htons(checksum_compute((uint16_t*)packet->icmp,
-                ntohs(packet->ipv4->length) - sizeof(ipv4_header_t)));
+    packet->icmp->checksum = checksum_compute((uint16_t*)packet->icmp,
+                ntohs(packet->ipv4->length) - sizeof(ipv4_header_t));
 }
 
-bool net_verify_icmp_checksum(packet_t *packet)
+/* Work out the sum of packet->buffer[start, end) from the sum the driver
+ * computed while copying the packet in, by taking away the parts of the
+ * buffer either side of the range. These are just the headers below start
+ * and any Ethernet padding above end, so this is much cheaper than summing
+ * the range itself. start must be even. Returns false if the driver did not
+ * supply a sum. For a packet received with packet_flag_rx_direct the range
+ * may run on past buffer[] to the end of the data at rx_direct; the driver
+ * only does that when there is no padding. */
+static bool checksum_rx_range(packet_t *packet, unsigned int start, unsigned int end, uint32_t *sum)
 {
-    return (checksum_compute((uint16_t*)packet->icmp, ntohs(packet->ipv4->length) - sizeof(ipv4_header_t)) == 0);
+    uint32_t excess;
+    unsigned int frame_length = packet->buffer_length;
+
+    if(packet->flags & packet_flag_rx_direct)
+        frame_length += packet->rx_direct_length;
+
+    if(!(packet->flags & packet_flag_rx_sum_valid) || end > frame_length)
+        return false;
+
+    excess = checksum_update(0, (uint16_t*)packet->buffer, start);
+    if((end & 1) && end < packet->buffer_length){
+        // the byte at end is the low half of a word that straddles the boundary
+        excess += htons(packet->buffer[end]);
+        end++;
+    }
+    if(end < packet->buffer_length)
+        excess = checksum_update(excess, (uint16_t*)(packet->buffer + end), packet->buffer_length - end);
+
+    // one's complement subtraction is addition of the complement
+    *sum = packet->rx_sum + checksum_complete(excess);
+    return true;
 }
 
-static uint16_t udp_checksum_pseudoheader(packet_t *packet)
+bool net_verify_icmp_checksum(packet_t *packet)
 {
+    unsigned int start = (uint8_t*)packet->icmp - packet->buffer;
+    unsigned int length = ntohs(packet->ipv4->length) - sizeof(ipv4_header_t);
     uint32_t sum;
+
+    if(!checksum_rx_range(packet, start, start + length, &sum))
+        sum = checksum_update(0, (uint16_t*)packet->icmp, length);
+
+    return checksum_complete(sum) == 0;
+}
+
+bool net_verify_igmp_checksum(packet_t *packet)
+{
+    // net_eth_push() has not checked the lengths for us
+    if((packet->ipv4->version_length & 0xf) < 5 || ntohs(packet->ipv4->length) < packet->data_length ||
+       packet->data_length < sizeof(igmp_header_t) || packet->data + packet->data_length > packet->buffer + packet->buffer_length)
+        return false;
+    return checksum_compute((uint16_t*)packet->data, packet->data_length) == 0;
+}
+
+static uint16_t udp_checksum_pseudoheader(packet_t *packet, bool use_rx_sum)
+{
+    unsigned int start, length;
+    uint32_t sum, data_sum;
+
     // we have to sum a "pseudo-header"
     sum = checksum_update(0, (uint16_t*)&packet->ipv4->source_ip, sizeof(uint32_t)*2);
-    sum += packet->ipv4->protocol;
+    sum += htons(packet->ipv4->protocol);
     sum += packet->udp->length; // yes, this field is summed twice!
                                 // ... then the real udp header + data
-    sum = checksum_update(sum, (uint16_t*)packet->udp, ntohs(packet->udp->length));
-    return htons(checksum_complete(sum));
+    start = (uint8_t*)packet->udp - packet->buffer;
+    length = ntohs(packet->udp->length);
+    if(!use_rx_sum || !checksum_rx_range(packet, start, start + length, &data_sum))
+        data_sum = checksum_update(0, (uint16_t*)packet->udp, length);
+    return htons(checksum_complete(sum + data_sum));
 }
 
 bool net_verify_udp_checksum(packet_t *packet)
 {
-    return (packet->udp->checksum == 0 || udp_checksum_pseudoheader(packet) == 0);
+    return (packet->udp->checksum == 0 || udp_checksum_pseudoheader(packet, true) == 0);
 }
 
 void net_compute_udp_checksum(packet_t *packet)
 {
     uint16_t cs;
     packet->udp->checksum = 0;
-    cs = udp_checksum_pseudoheader(packet);
+    cs = udp_checksum_pseudoheader(packet, false);
     if(cs == 0) 
         cs = 0xffff; // per RFC768
     packet->udp->checksum = htons(cs);
 }
 
+static uint16_t tcp_checksum_pseudoheader(packet_t *packet, bool use_rx_sum)
+{
+    unsigned int start, length;
+    uint32_t sum, data_sum;
+
+    // same pseudo-header as UDP, but TCP has no length field of its own
+    length = ntohs(packet->ipv4->length) - sizeof(ipv4_header_t);
+    sum = checksum_update(0, (uint16_t*)&packet->ipv4->source_ip, sizeof(uint32_t)*2);
+    sum += htons(packet->ipv4->protocol);
+    sum += htons(length);
+    start = (uint8_t*)packet->tcp - packet->buffer;
+    if(!use_rx_sum || !checksum_rx_range(packet, start, start + length, &data_sum))
+        data_sum = checksum_update(0, (uint16_t*)packet->tcp, length);
+    return htons(checksum_complete(sum + data_sum));
+}
+
 bool net_verify_tcp_checksum(packet_t *packet)
 {
-    // printf("write net_verify_tcp_checksum!\n");
-    return true;
+    return tcp_checksum_pseudoheader(packet, true) == 0;
 }
 
 void net_compute_tcp_checksum(packet_t *packet)
 {
-    printf("write net_compute_tcp_checksum!\n");
+    packet->tcp->checksum = 0;
+    packet->tcp->checksum = htons(tcp_checksum_pseudoheader(packet, false));
 }
-
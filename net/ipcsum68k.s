@@ -0,0 +1,84 @@
+        .globl  net_checksum_update
+
+        .text
+        .even
+
+/* uint32_t net_checksum_update(uint32_t sum, const void *addr, unsigned int count)
+
+   Internet checksum inner loop: accumulates the 16-bit one's complement sum
+   of count bytes at addr into sum. The data is summed as longwords with the
+   carry chained through addx.l, which gives the same result modulo 0xFFFF as
+   summing words. addr must be even. A trailing odd byte is padded with zero,
+   as RFC 1071 requires.
+
+   The result is folded to at most 17 bits so that callers can safely add a
+   few more 16-bit terms (pseudo-header fields) before checksum_complete().
+
+   68020 and later have an instruction cache, so we unroll to 64 bytes per
+   iteration which keeps the loop well inside the cache. The 68000 and 68008
+   have no cache and a slow bus, so the win from unrolling flattens out much
+   sooner; there we unroll to 32 bytes to keep the ROM footprint down. */
+
+.ifdef TARGET_MINI
+        .set    CSUM_SHIFT, 5           /* 32 bytes per unrolled block */
+.else
+        .set    CSUM_SHIFT, 6           /* 64 bytes per unrolled block */
+.endif
+
+net_checksum_update:
+        movem.l %d2-%d4,-(%sp)
+        move.l  %sp@(16),%d0            /* uint32_t sum */
+        moveal  %sp@(20),%a0            /* const void *addr */
+        move.l  %sp@(24),%d4            /* unsigned int count */
+        moveq   #0,%d3                  /* constant zero, to fold in the carry */
+
+        move.l  %d4,%d2
+        lsr.l   #CSUM_SHIFT,%d2         /* number of whole unrolled blocks */
+        beq.s   csum_tail
+
+csum_block:
+        add.l   (%a0)+,%d0              /* first add starts a fresh carry chain */
+        .rept   (1<<CSUM_SHIFT)/4-1
+        move.l  (%a0)+,%d1              /* move leaves X untouched ... */
+        addx.l  %d1,%d0                 /* ... so the carry ripples through */
+        .endr
+        addx.l  %d3,%d0                 /* end around carry */
+        subq.l  #1,%d2
+        bne.s   csum_block
+
+csum_tail:
+        move.w  %d4,%d2
+        andi.w  #((1<<CSUM_SHIFT)-4),%d2
+        lsr.w   #2,%d2                  /* remaining whole longwords */
+        bra.s   csum_longloop
+csum_long:
+        add.l   (%a0)+,%d0
+        addx.l  %d3,%d0
+csum_longloop:
+        dbra    %d2,csum_long
+
+        btst    #1,%d4                  /* trailing word? */
+        beq.s   csum_byte
+        moveq   #0,%d1
+        move.w  (%a0)+,%d1
+        add.l   %d1,%d0
+        addx.l  %d3,%d0
+
+csum_byte:
+        btst    #0,%d4                  /* trailing byte? */
+        beq.s   csum_fold
+        moveq   #0,%d1
+        move.b  (%a0),%d1
+        lsl.w   #8,%d1                  /* pad on the right with zero */
+        add.l   %d1,%d0
+        addx.l  %d3,%d0
+
+csum_fold:
+        move.l  %d0,%d1
+        clr.w   %d1
+        swap    %d1                     /* high word */
+        andi.l  #0xffff,%d0             /* low word */
+        add.l   %d1,%d0                 /* at most 0x1fffe */
+
+        movem.l (%sp)+,%d2-%d4
+        rts
@@ -38,19 +38,29 @@ packet_t *packet_create_icmp(uint32_t dest_ipv4, int data_size)
     return p;
 }
 
+// IGMP messages must not leave the local network (RFC 2236)
+packet_t *packet_create_igmp(uint32_t dest_ipv4, int data_size)
+{
+    packet_t *p = packet_create_ipv4(dest_ipv4, data_size, ip_proto_igmp);
+    p->ipv4->ttl = 1;
+    p->data = p->ipv4->payload;
+    p->data_length = data_size;
+    return p;
+}
+
 packet_t *packet_create_tcp(uint32_t dest_ipv4, uint16_t destination_port, uint16_t source_port, int data_size)
 {
-    packet_t *p = packet_create_ipv4(dest_ipv4, data_size + sizeof(tcp_header_t), ip_proto_udp);
+    packet_t *p = packet_create_ipv4(dest_ipv4, data_size + sizeof(tcp_header_t), ip_proto_tcp);
     p->tcp = (tcp_header_t*)p->ipv4->payload;
-    p->data = (uint8_t*)p->tcp->options; // + options_size
-    p->data_length = data_size;          // - options_size
-
-    printf("packet_create_tcp is incomplete!\n");
-
-    // set up tcp header
-    // p->tcp->... = ...;
+    p->data = (uint8_t*)p->tcp->options; // no options; a caller adding them must adjust data_offset
+    p->data_length = data_size;
 
-    // p->data needs to be computed depending on tcp option headers present.
+    // set up tcp header; sequence, ack, flags and window are up to the caller
+    p->tcp->source_port = htons(source_port);
+    p->tcp->destination_port = htons(destination_port);
+    p->tcp->data_offset = (sizeof(tcp_header_t) / 4) << 4;
+    p->tcp->flags = 0;
+    p->tcp->urgent_pointer = 0;
 
     return p;
 }
@@ -121,6 +131,22 @@ packet_t *packet_create_for_sink(packet_sink_t *sink, int data_size)
     }
 }
 
+// buffer must have room for 16 characters
+void net_format_ipv4(char *buffer, uint32_t ip)
+{
+    int shift, octet;
+
+    for(shift=24; shift>=0; shift-=8){
+        octet = (ip >> shift) & 0xff;
+        if(octet >= 100)
+            *buffer++ = '0' + octet / 100;
+        if(octet >= 10)
+            *buffer++ = '0' + (octet / 10) % 10;
+        *buffer++ = '0' + octet % 10;
+        *buffer++ = shift ? '.' : 0;
+    }
+}
+
 uint32_t net_parse_ipv4(const char *input)
 {
     uint32_t result=0, octet;
@@ -13,25 +13,46 @@ uint32_t interface_ipv4_address = 0; // IPv4 address of our interface
 uint32_t interface_subnet_mask = 0;
 uint32_t interface_ipv4_gateway = 0;
 uint32_t interface_dns_server = 0;
+uint32_t interface_boot_server = 0; // from DHCP: BOOTP siaddr, or option 66
+char interface_boot_file[DHCP_BOOT_FILE_MAX]; // from DHCP: BOOTP file, or option 67
 
 static packet_sink_t *net_packet_sink_head = NULL;
+static packet_sink_t *net_rx_direct_sink = NULL;
 static packet_queue_t *net_txqueue = NULL;
 static packet_t *net_arp_lookup_list_head = NULL;
 
 uint32_t packet_alive_count = 0;
 uint32_t packet_discard_count = 0;
 uint32_t packet_bad_cksum_count = 0;
+uint32_t packet_bad_ipv4_cksum_count = 0;
+uint32_t packet_bad_udp_cksum_count = 0;
+uint32_t packet_bad_tcp_cksum_count = 0;
+uint32_t packet_bad_icmp_cksum_count = 0;
+uint32_t packet_bad_igmp_cksum_count = 0;
 uint32_t packet_rx_count = 0;
 uint32_t packet_tx_count = 0;
+uint32_t packet_pool_high_water = 0;
+uint32_t packet_pool_exhausted_count = 0;
+int packet_txqueue_length = 0;
+int packet_txqueue_high_water = 0;
 
 void net_init(void)
 {
+    packet_pool_init();
     net_txqueue = packet_queue_alloc();
     net_arp_lookup_list_head = NULL;
     net_arp_init();
     net_icmp_init();
 }
 
+static void net_txqueue_add(packet_t *packet)
+{
+    packet_queue_addtail(net_txqueue, packet);
+    packet_txqueue_length++;
+    if(packet_txqueue_length > packet_txqueue_high_water)
+        packet_txqueue_high_water = packet_txqueue_length;
+}
+
 static void net_arp_resolver_pump(void)
 {
     packet_t *packet, **packet_ptr;
@@ -53,7 +74,7 @@ static void net_arp_resolver_pump(void)
 
             if(r == arp_okay){
                 // move it onto the transmit queue
-                packet_queue_addtail(net_txqueue, packet);
+                net_txqueue_add(packet);
             }else{ // r == arp_fail
                 // we couldn't resolve it
                 packet_free(packet);
@@ -110,76 +131,90 @@ static int score_sink(packet_sink_t *sink)
     return matches;
 }
 
+/*
+ * Received packets are matched to sinks using a small hash table keyed on
+ * (protocol, local port, remote port). Sinks that match on a protocol and
+ * local port live in the table, keyed with remote port 0 if they accept any
+ * remote port. All other sinks live on a wildcard chain. Each chain is sorted
+ * with the most specific sinks first, so the first match in a chain is the
+ * best one; we then pick the most specific of the candidates from the two
+ * table chains and the wildcard chain.
+ */
+#define NET_DEMUX_BUCKETS 16 /* must be a power of two */
+static packet_sink_t *net_demux_table[NET_DEMUX_BUCKETS];
+static packet_sink_t *net_demux_wildcard_head = NULL;
+
+static int net_demux_hash(uint8_t protocol, uint16_t local_port, uint16_t remote_port)
+{
+    return (protocol ^ local_port ^ (local_port >> 8) ^ (remote_port * 5) ^ (remote_port >> 8)) & (NET_DEMUX_BUCKETS - 1);
+}
+
+static packet_sink_t **net_demux_chain(packet_sink_t *sink)
+{
+    if(sink->match_ipv4_protocol && sink->match_local_port)
+        return &net_demux_table[net_demux_hash(sink->match_ipv4_protocol, sink->match_local_port, sink->match_remote_port)];
+    return &net_demux_wildcard_head;
+}
+
 void net_add_packet_sink(packet_sink_t *sink)
 {
-    int score;
     packet_sink_t **ptr;
-    packet_sink_t *entry;
 
-    if(sink->next){
+    if(sink->next || sink->demux_next){
         printf("net_add_packet_sink: already in a list?\n");
         return;
     }
 
-    // first sink?
-    if(net_packet_sink_head == NULL){
-        net_packet_sink_head = sink;
-        return;
-    }
-
     // count how many parameters this sink matches against
-    score = score_sink(sink);
-
-    // place it in the list in sorted order: we want to test
-    // the most specific sinks first
-    ptr = &net_packet_sink_head;
-    entry = net_packet_sink_head;
-    while(entry){
-        if(score_sink(entry) <= score){
-            // insert
-            *ptr = sink;
-            sink->next = entry;
-            return;
-        }
-        if(entry->next == NULL){
-            entry->next = sink;
-            return;
-        }
-        // walk list
-        ptr = &entry->next;
-        entry = entry->next;
-    }
+    sink->match_score = score_sink(sink);
+
+    // all sinks go on the main list, which net_pump() walks
+    sink->next = net_packet_sink_head;
+    net_packet_sink_head = sink;
+
+    // place it in its demux chain in sorted order: we want to test
+    // the most specific sinks first (newer sinks win a tie)
+    ptr = net_demux_chain(sink);
+    while(*ptr && (*ptr)->match_score > sink->match_score)
+        ptr = &(*ptr)->demux_next;
+    sink->demux_next = *ptr;
+    *ptr = sink;
 }
 
-void net_remove_packet_sink(packet_sink_t *sink)
+static bool net_unlink_sink(packet_sink_t **ptr, packet_sink_t *sink, bool demux)
 {
-    packet_sink_t **ptr;
-    packet_sink_t *entry;
-
-    ptr = &net_packet_sink_head;
-    entry = net_packet_sink_head;
-
-    while(entry){
-        if(entry == sink){
+    while(*ptr){
+        if(*ptr == sink){
             // we got it!
-            *ptr = entry->next;
-            entry->next = NULL;
-            return;
-        }else{
-            // walk list
-            ptr = &entry->next;
-            entry = entry->next;
+            if(demux){
+                *ptr = sink->demux_next;
+                sink->demux_next = NULL;
+            }else{
+                *ptr = sink->next;
+                sink->next = NULL;
+            }
+            return true;
         }
+        // walk list
+        ptr = demux ? &(*ptr)->demux_next : &(*ptr)->next;
     }
+    return false;
+}
 
-    printf("net_remove_packet_sink: can't find it?\n");
+void net_remove_packet_sink(packet_sink_t *sink)
+{
+    if(sink == net_rx_direct_sink)
+        net_rx_direct_sink = NULL;
+    if(!net_unlink_sink(&net_packet_sink_head, sink, false) ||
+       !net_unlink_sink(net_demux_chain(sink), sink, true))
+        printf("net_remove_packet_sink: can't find it?\n");
 }
 
 void net_dump_packet_sinks(void) // used by "netinfo" command
 {
     packet_sink_t *sink = net_packet_sink_head;
     while(sink){
-        printf("packet_sink @ 0x%lx:\n  ipv4_protocol=0x%x, local_ip=0x%lx, if_ip=%s, remote_ip=0x%lx, local_port=%d, remote_port=%d\n  ethertype=0x%x, queue_len=%d, packets_queued=%ld, timer=%ld, callbacks:%s%s\n",
+        printf("packet_sink @ 0x%lx:\n  ipv4_protocol=0x%x, local_ip=0x%lx, if_ip=%s, remote_ip=0x%lx, local_port=%d, remote_port=%d\n  ethertype=0x%x, queue_len=%d (max %d), packets_queued=%ld, timer=%ld, callbacks:%s%s\n",
                 (long)sink,
                 sink->match_ipv4_protocol,
                 sink->match_local_ip,
@@ -189,6 +224,7 @@ void net_dump_packet_sinks(void) // used by "netinfo" command
                 sink->match_remote_port,
                 sink->match_ethertype,
                 packet_queue_length(&sink->queue),
+                sink->queue_high_water,
                 sink->packets_queued,
                 sink->timer ? sink->timer - gogoboot_read_timer() : -1,
                 sink->cb_timer_expired ? " timer":"",
@@ -199,16 +235,178 @@ void net_dump_packet_sinks(void) // used by "netinfo" command
 
 }
 
+void net_histogram_add(net_histogram_t *h, timer_t ticks)
+{
+    int b = 0;
+
+    while(ticks && b < NET_HISTOGRAM_BUCKETS-1){
+        ticks >>= 1;
+        b++;
+    }
+    h->bucket[b]++;
+}
+
+void net_histogram_print(const char *name, const net_histogram_t *h)
+{
+    printf("%s (ms):", name);
+    for(int b=0; b<NET_HISTOGRAM_BUCKETS; b++)
+        printf(" %d%s:%ld", b ? (1 << (b-1)) * TIMER_MS_PER_TICK : 0,
+                b == NET_HISTOGRAM_BUCKETS-1 ? "+" : "", h->bucket[b]);
+    putchar('\n');
+}
+
+void net_reset_stats(void) // used by "netinfo reset"
+{
+    packet_sink_t *sink;
+
+    packet_rx_count = packet_tx_count = 0;
+    packet_discard_count = 0;
+    packet_bad_cksum_count = 0;
+    packet_bad_ipv4_cksum_count = packet_bad_udp_cksum_count = 0;
+    packet_bad_tcp_cksum_count = packet_bad_icmp_cksum_count = 0;
+    packet_bad_igmp_cksum_count = 0;
+    packet_pool_exhausted_count = 0;
+    packet_pool_high_water = packet_alive_count;
+    packet_txqueue_high_water = packet_txqueue_length;
+    arp_hit_count = arp_miss_count = arp_stall_count = arp_refresh_count = 0;
+    memset(&tftp_ack_rtt_histogram, 0, sizeof(tftp_ack_rtt_histogram));
+
+    for(sink = net_packet_sink_head; sink; sink = sink->next){
+        sink->packets_queued = 0;
+        sink->queue_high_water = packet_queue_length(&sink->queue);
+    }
+
+    eth_reset_stats();
+}
+
 // --- receive pipe ---
 
+typedef struct {
+    uint16_t ethertype;
+    uint8_t  protocol;
+    uint32_t destination_ip;
+    uint32_t source_ip;
+    uint16_t destination_port;
+    uint16_t source_port;
+} net_demux_key_t;
+
+static bool net_sink_matches(packet_sink_t *sink, packet_t *packet, net_demux_key_t *key)
+{
+    return (sink->match_ethertype == 0      || (sink->match_ethertype == key->ethertype)) &&
+           (sink->match_ipv4_protocol == 0  || (packet->ipv4 && sink->match_ipv4_protocol == key->protocol)) &&
+           (sink->match_local_ip == 0       || (packet->ipv4 && sink->match_local_ip == key->destination_ip)) &&
+           (!sink->match_interface_local_ip || (packet->ipv4 && interface_ipv4_address && interface_ipv4_address == key->destination_ip)) &&
+           (sink->match_remote_ip == 0      || (packet->ipv4 && sink->match_remote_ip == key->source_ip)) &&
+           (sink->match_local_port == 0     || ((packet->tcp || packet->udp) && sink->match_local_port == key->destination_port)) &&
+           (sink->match_remote_port == 0    || ((packet->tcp || packet->udp) && sink->match_remote_port == key->source_port));
+}
+
+// return the first sink in a demux chain that matches and is more specific than min_score (-1 for any)
+static packet_sink_t *net_demux_first_match(packet_sink_t *sink, packet_t *packet, net_demux_key_t *key, int min_score)
+{
+    while(sink && sink->match_score > min_score){
+        if(net_sink_matches(sink, packet, key))
+            return sink;
+        sink = sink->demux_next;
+    }
+    return NULL;
+}
+
+/*
+ * Receive hint: one UDP sink at a time can have the driver put the payload of
+ * its packets straight into their final location, rather than into a packet
+ * buffer from which the sink would copy it again. The driver reads the
+ * headers first and calls net_rx_direct_target(), which checks that the
+ * frame is a plain UDP datagram for the sink and asks the sink's
+ * cb_rx_direct where the rest of the payload goes. The driver then streams
+ * it from the card to there, and the packet is queued for the sink as usual
+ * with only the headers in buffer[]. The sink must not rely on the data at
+ * rx_direct until the packet reaches it, since a packet that fails its
+ * checksum is dropped after the data has been written. Nor may cb_rx_direct
+ * hand out the same space twice while a packet written there is still
+ * queued: a second frame would overwrite the first, and if it then failed
+ * its checksum the queued packet would point at bad data. It should only
+ * hand out space that nothing else depends on yet, and at most once.
+ */
+void net_set_rx_direct_sink(packet_sink_t *sink)
+{
+    if(sink && (!sink->cb_rx_direct || (sink->rx_direct_header & 1))){
+        printf("net_set_rx_direct_sink: bad sink\n");
+        return;
+    }
+    net_rx_direct_sink = sink;
+}
+
+int net_rx_direct_header_length(void)
+{
+    if(!net_rx_direct_sink)
+        return 0;
+    return sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) + net_rx_direct_sink->rx_direct_header;
+}
+
+// called by ne2000.c with the first net_rx_direct_header_length() bytes of
+// the frame in packet->buffer, and buffer_length set to the frame length
+uint8_t *net_rx_direct_target(packet_t *packet)
+{
+    packet_sink_t *sink = net_rx_direct_sink;
+    net_demux_key_t key;
+    ipv4_header_t *ipv4;
+    udp_header_t *udp;
+    uint8_t *target;
+    int header, length;
+
+    if(!sink)
+        return NULL;
+
+    header = net_rx_direct_header_length();
+    ipv4 = (ipv4_header_t*)packet->eth->payload;
+    udp = (udp_header_t*)ipv4->payload;
+
+    // only unfragmented datagrams without IP options, with no Ethernet
+    // padding after them, so the payload runs to the end of the frame
+    if(memcmp(packet->eth->destination_mac, interface_macaddr, sizeof(macaddr_t)) != 0 ||
+       ntohs(packet->eth->ethertype) != ethertype_ipv4 ||
+       ipv4->version_length != 0x45 || ipv4->protocol != ip_proto_udp ||
+       (ntohs(ipv4->flags_and_frags) & 0x3fff) != 0 ||
+       ntohs(ipv4->length) != packet->buffer_length - sizeof(ethernet_header_t) ||
+       ntohs(udp->length) != ntohs(ipv4->length) - sizeof(ipv4_header_t))
+        return NULL;
+
+    length = packet->buffer_length - header;
+    if(length <= 0)
+        return NULL;
+
+    key.ethertype        = ethertype_ipv4;
+    key.protocol         = ip_proto_udp;
+    key.destination_ip   = ntohl(ipv4->destination_ip);
+    key.source_ip        = ntohl(ipv4->source_ip);
+    key.destination_port = ntohs(udp->destination_port);
+    key.source_port      = ntohs(udp->source_port);
+    packet->ipv4 = ipv4; // as net_eth_push() will set them; net_sink_matches() tests these
+    packet->udp = udp;
+    if(!net_sink_matches(sink, packet, &key))
+        return NULL;
+
+    target = sink->cb_rx_direct(sink, udp->payload, length);
+    if(!target || ((uint32_t)target & 1)) // the drivers want an even address
+        return NULL;
+
+    packet->flags |= packet_flag_rx_direct;
+    packet->rx_direct = target;
+    packet->rx_direct_length = length;
+    packet->buffer_length = header;
+    return target;
+}
+
 // called by ne2000.c via eth_pump()
 // this function should check and queue a packet for later delivery
 // to prevent potential re-entrancy, do NOT make any callbacks to sinks in here
 void net_eth_push(packet_t *packet)
 {
-    int header_size;
+    int header_size, depth;
 
     packet_rx_count++;
+    netcap_packet(packet);
 
     // check that the destination MAC is either our MAC, or a multicast MAC
     if(memcmp(packet->eth->destination_mac, interface_macaddr, sizeof(macaddr_t)) == 0 ||
@@ -217,30 +415,48 @@ void net_eth_push(packet_t *packet)
         switch(ntohs(packet->eth->ethertype)){
             case ethertype_ipv4:
                 packet->ipv4 = (ipv4_header_t*)packet->eth->payload;
-                if(!net_verify_ipv4_checksum(packet))
+                if(!net_verify_ipv4_checksum(packet)){
+                    packet_bad_ipv4_cksum_count++;
                     goto bad_cksum;
+                }
                 switch(packet->ipv4->protocol){
                     case ip_proto_tcp:
-                        header_size = ((packet->tcp->data_offset & 0x0F) << 2);
                         packet->tcp = (tcp_header_t*)packet->ipv4->payload;
+                        header_size = ((packet->tcp->data_offset >> 4) << 2);
                         packet->data = packet->ipv4->payload + header_size;
-                        packet->data_length = ntohs(packet->ipv4->length) - header_size;
-                        if(!net_verify_tcp_checksum(packet))
+                        packet->data_length = ntohs(packet->ipv4->length) - sizeof(ipv4_header_t) - header_size;
+                        if(!net_verify_tcp_checksum(packet)){
+                            packet_bad_tcp_cksum_count++;
                             goto bad_cksum;
+                        }
                         break;
                     case ip_proto_udp:
                         packet->udp = (udp_header_t*)packet->ipv4->payload;
                         packet->data = packet->udp->payload;
                         packet->data_length = ntohs(packet->udp->length) - sizeof(udp_header_t);
-                        if(!net_verify_udp_checksum(packet))
+                        if(!net_verify_udp_checksum(packet)){
+                            packet_bad_udp_cksum_count++;
                             goto bad_cksum;
+                        }
                         break;
                     case ip_proto_icmp:
                         packet->icmp = (icmp_header_t*)packet->ipv4->payload;
                         packet->data = packet->icmp->payload;
                         packet->data_length = ntohs(packet->ipv4->length) - sizeof(icmp_header_t) - sizeof(ipv4_header_t);
-                        if(!net_verify_icmp_checksum(packet))
+                        if(!net_verify_icmp_checksum(packet)){
+                            packet_bad_icmp_cksum_count++;
+                            goto bad_cksum;
+                        }
+                        break;
+                    case ip_proto_igmp:
+                        // queries carry the Router Alert option, so go by the header length
+                        header_size = (packet->ipv4->version_length & 0xf) << 2;
+                        packet->data = (uint8_t*)packet->ipv4 + header_size;
+                        packet->data_length = ntohs(packet->ipv4->length) - header_size;
+                        if(!net_verify_igmp_checksum(packet)){
+                            packet_bad_igmp_cksum_count++;
                             goto bad_cksum;
+                        }
                         break;
                     default:
                         // unhandled ipv4 protocol
@@ -257,27 +473,39 @@ void net_eth_push(packet_t *packet)
 
         // figure out the best matching queue to put it into
         // convert key fields to cpu byte order (avoids doing this for every sink)
-        uint16_t ethertype        = ntohs(packet->eth->ethertype);
-        uint16_t protocol         = ntohs(packet->ipv4->protocol);
-        uint32_t destination_ip   = ntohl(packet->ipv4->destination_ip);
-        uint32_t source_ip        = ntohl(packet->ipv4->source_ip);
-        uint16_t destination_port = packet->tcp ? ntohs(packet->tcp->destination_port) : (packet->udp ? ntohs(packet->udp->destination_port) : 0);
-        uint16_t source_port      = packet->tcp ? ntohs(packet->tcp->source_port)      : (packet->udp ? ntohs(packet->udp->source_port)      : 0);
-        packet_sink_t *sink = net_packet_sink_head;
-        while(sink){
-            if( (sink->match_ethertype == 0      || (sink->match_ethertype == ethertype)) &&
-                (sink->match_ipv4_protocol == 0  || (packet->ipv4 && sink->match_ipv4_protocol == protocol)) &&
-                (sink->match_local_ip == 0       || (packet->ipv4 && sink->match_local_ip == destination_ip)) &&
-                (!sink->match_interface_local_ip || (packet->ipv4 && interface_ipv4_address && interface_ipv4_address == destination_ip)) &&
-                (sink->match_remote_ip == 0      || (packet->ipv4 && sink->match_remote_ip == source_ip)) &&
-                (sink->match_local_port == 0     || ((packet->tcp || packet->udp) && sink->match_local_port == destination_port)) &&
-                (sink->match_remote_port == 0    || ((packet->tcp || packet->udp) && sink->match_remote_port == source_port)) ){
-                // enqueue the packet for later processing
-                packet_queue_addtail(&sink->queue, packet);
-                sink->packets_queued++;
-                return;
-            }
-            sink = sink->next;
+        net_demux_key_t key;
+        packet_sink_t *sink, *best;
+        key.ethertype        = ntohs(packet->eth->ethertype);
+        key.protocol         = packet->ipv4 ? packet->ipv4->protocol : 0;
+        key.destination_ip   = packet->ipv4 ? ntohl(packet->ipv4->destination_ip) : 0;
+        key.source_ip        = packet->ipv4 ? ntohl(packet->ipv4->source_ip) : 0;
+        key.destination_port = packet->tcp ? ntohs(packet->tcp->destination_port) : (packet->udp ? ntohs(packet->udp->destination_port) : 0);
+        key.source_port      = packet->tcp ? ntohs(packet->tcp->source_port)      : (packet->udp ? ntohs(packet->udp->source_port)      : 0);
+
+        best = NULL;
+        if(packet->tcp || packet->udp){
+            best = net_demux_first_match(net_demux_table[net_demux_hash(key.protocol, key.destination_port, key.source_port)], packet, &key, -1);
+            sink = net_demux_first_match(net_demux_table[net_demux_hash(key.protocol, key.destination_port, 0)], packet, &key,
+                    best ? best->match_score : -1);
+            if(sink)
+                best = sink;
+        }
+        sink = net_demux_first_match(net_demux_wildcard_head, packet, &key, best ? best->match_score : -1);
+        if(sink)
+            best = sink;
+
+        // a packet received in place must reach the sink that placed it
+        if(best && (packet->flags & packet_flag_rx_direct) && best != net_rx_direct_sink)
+            best = NULL;
+
+        if(best){
+            // enqueue the packet for later processing
+            packet_queue_addtail(&best->queue, packet);
+            best->packets_queued++;
+            depth = packet_queue_length(&best->queue);
+            if(depth > best->queue_high_water)
+                best->queue_high_water = depth;
+            return;
         }
     }
 
@@ -311,14 +539,14 @@ void net_tx(packet_t *packet)
 {
     // don't transmit from 0.0.0.0 unless it's DHCP
     if(packet->ipv4 && packet->ipv4->source_ip == htonl(0) &&
-            !(packet->udp && packet->udp->source_port == 68 && packet->udp->destination_port == 67)){
+            !(packet->udp && packet->udp->source_port == htons(68) && packet->udp->destination_port == htons(67))){
         packet_free(packet);
         printf("net_tx: no ipv4 address!\n");
         return;
     }
 
     // compute checksums
-    if(packet->eth->ethertype == ethertype_ipv4){
+    if(ntohs(packet->eth->ethertype) == ethertype_ipv4){
         net_compute_ipv4_checksum(packet);
         switch(packet->ipv4->protocol){
             case ip_proto_tcp:
@@ -340,10 +568,11 @@ void net_tx(packet_t *packet)
     if(packet->flags & packet_flag_destination_mac_valid || net_arp_resolve(packet) == arp_okay){
         // we want to start the transmission immediately if we have buffer space on the card,
         // otherwise we have to queue the packet for transmission later
-        if(eth_attempt_tx(packet))
+        if(eth_attempt_tx(packet)){
+            netcap_packet(packet);
             packet_free(packet);
-        else
-            packet_queue_addtail(net_txqueue, packet);
+        }else
+            net_txqueue_add(packet);
     }else{
         // add to the list of packets awaiting ARP resolution
         packet->next = net_arp_lookup_list_head;
@@ -357,5 +586,9 @@ void net_tx(packet_t *packet)
 packet_t *net_eth_pull(void)
 {
     packet_t *p = packet_queue_pophead(net_txqueue);
+    if(p){
+        packet_txqueue_length--;
+        netcap_packet(p);
+    }
     return p;
 }
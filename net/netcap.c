@@ -0,0 +1,226 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <fatfs/ff.h>
+#include <cli.h>
+#include <net.h>
+
+// Packet capture. While running, every frame handed up by the driver and
+// every frame handed to it is copied, cut to the snap length, into the next
+// slot of a fixed ring in RAM, overwriting the oldest once the ring is full.
+// Recording is a single memcpy, so capturing disturbs the traffic under
+// study as little as we can manage. netcap_save() writes the ring out as a
+// classic pcap file, which tcpdump and wireshark read directly.
+//
+// documentation:
+// https://wiki.wireshark.org/Development/LibpcapFileFormat
+
+#define NETCAP_DEFAULT_KB      64
+#define NETCAP_DEFAULT_SNAPLEN 128
+#define NETCAP_MIN_SNAPLEN     ((int)(sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t)))
+
+#define PCAP_MAGIC      0xa1b2c3d4
+#define PCAP_LINKTYPE_ETHERNET 1
+
+typedef struct {
+    timer_t ticks;
+    uint16_t length;            // length of the frame
+    uint16_t captured;          // bytes of it that follow
+    uint8_t data[];
+} netcap_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+} pcap_file_header_t;
+
+typedef struct {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} pcap_record_header_t;
+
+bool netcap_active = false;
+static uint8_t *netcap_ring = NULL;
+static int netcap_slot_count;     // slots in the ring
+static int netcap_slot_size;      // bytes per slot, a multiple of 4
+static int netcap_snaplen;
+static int netcap_next;           // slot to fill next
+static uint32_t netcap_frames;    // frames recorded since netcap_start()
+static timer_t netcap_start_ticks;
+
+static netcap_slot_t *netcap_slot(int n)
+{
+    return (netcap_slot_t*)(netcap_ring + n * netcap_slot_size);
+}
+
+bool netcap_start(int kbytes, int snaplen)
+{
+    int size;
+
+    netcap_stop();
+    free(netcap_ring);
+    netcap_ring = NULL;
+
+    if(kbytes <= 0)
+        kbytes = NETCAP_DEFAULT_KB;
+    if(snaplen <= 0)
+        snaplen = NETCAP_DEFAULT_SNAPLEN;
+    if(snaplen < NETCAP_MIN_SNAPLEN)
+        snaplen = NETCAP_MIN_SNAPLEN;
+    if(snaplen > PACKET_MAXLEN)
+        snaplen = PACKET_MAXLEN;
+
+    netcap_snaplen = snaplen;
+    netcap_slot_size = (sizeof(netcap_slot_t) + snaplen + 3) & ~3;
+
+    // fall back to a smaller ring when the heap is small
+    for(size = kbytes << 10; size >= netcap_slot_size * 4; size /= 2){
+        netcap_ring = malloc_unchecked(size);
+        if(netcap_ring)
+            break;
+    }
+    if(!netcap_ring){
+        printf("netcap: not enough memory\n");
+        return false;
+    }
+
+    netcap_slot_count = size / netcap_slot_size;
+    netcap_next = 0;
+    netcap_frames = 0;
+    netcap_start_ticks = gogoboot_read_timer();
+    netcap_active = true;
+
+    printf("netcap: capturing up to %d frames of %d bytes (%d KB)\n",
+            netcap_slot_count, netcap_snaplen, size >> 10);
+    return true;
+}
+
+void netcap_stop(void)
+{
+    netcap_active = false;
+}
+
+void netcap_record(packet_t *packet)
+{
+    netcap_slot_t *slot = netcap_slot(netcap_next);
+    int length, captured, part;
+
+    length = packet->buffer_length;
+    if(packet->flags & packet_flag_rx_direct)
+        length += packet->rx_direct_length;
+
+    captured = length < netcap_snaplen ? length : netcap_snaplen;
+    slot->ticks = gogoboot_read_timer();
+    slot->length = length;
+    slot->captured = captured;
+
+    // a frame received in place has only its headers in buffer[]
+    part = captured < packet->buffer_length ? captured : packet->buffer_length;
+    memcpy(slot->data, packet->buffer, part);
+    if(part < captured)
+        memcpy(slot->data + part, packet->rx_direct, captured - part);
+
+    if(++netcap_next == netcap_slot_count)
+        netcap_next = 0;
+    netcap_frames++;
+}
+
+void netcap_status(void)
+{
+    if(!netcap_ring){
+        printf("netcap: no capture\n");
+        return;
+    }
+    printf("netcap: %s, %ld frames seen, %ld held (ring of %d, snaplen %d)\n",
+            netcap_active ? "running" : "stopped", netcap_frames,
+            netcap_frames < netcap_slot_count ? netcap_frames : (uint32_t)netcap_slot_count,
+            netcap_slot_count, netcap_snaplen);
+}
+
+static bool netcap_write(FIL *fd, const char *filename, const void *data, UINT size)
+{
+    FRESULT fr;
+    UINT written;
+
+    fr = f_write(fd, data, size, &written);
+    if(fr != FR_OK){
+        printf("netcap: failed to write \"%s\": %s\n", filename, f_errmsg(fr));
+        return false;
+    }
+    if(written != size){
+        printf("netcap: failed to write \"%s\": disk full\n", filename);
+        return false;
+    }
+    return true;
+}
+
+// the capture is stopped while we save it, so the ring holds still
+bool netcap_save(const char *filename)
+{
+    pcap_file_header_t file_header;
+    pcap_record_header_t record;
+    netcap_slot_t *slot;
+    uint32_t held, ms;
+    int n;
+    FRESULT fr;
+    FIL fd;
+    bool ok = true;
+
+    if(!netcap_ring){
+        printf("netcap: no capture\n");
+        return false;
+    }
+    netcap_stop();
+
+    fr = f_open(&fd, filename, FA_WRITE | FA_CREATE_ALWAYS);
+    if(fr != FR_OK){
+        printf("netcap: failed to open \"%s\": %s\n", filename, f_errmsg(fr));
+        return false;
+    }
+
+    // pcap files are written in our own byte order; the magic number tells readers which
+    file_header.magic = PCAP_MAGIC;
+    file_header.version_major = 2;
+    file_header.version_minor = 4;
+    file_header.thiszone = 0;
+    file_header.sigfigs = 0;
+    file_header.snaplen = netcap_snaplen;
+    file_header.network = PCAP_LINKTYPE_ETHERNET;
+    ok = netcap_write(&fd, filename, &file_header, sizeof(file_header));
+
+    // oldest first: once the ring has wrapped that is the slot we would fill next
+    held = netcap_frames < netcap_slot_count ? netcap_frames : netcap_slot_count;
+    n = netcap_frames < netcap_slot_count ? 0 : netcap_next;
+    for(uint32_t i=0; ok && i<held; i++){
+        slot = netcap_slot(n);
+        // timestamps count from the start of the capture, at the timer's resolution
+        ms = (slot->ticks - netcap_start_ticks) * TIMER_MS_PER_TICK;
+        record.ts_sec = ms / 1000;
+        record.ts_usec = (ms % 1000) * 1000;
+        record.incl_len = slot->captured;
+        record.orig_len = slot->length;
+        ok = netcap_write(&fd, filename, &record, sizeof(record)) &&
+             netcap_write(&fd, filename, slot->data, slot->captured);
+        if(++n == netcap_slot_count)
+            n = 0;
+    }
+
+    fr = f_close(&fd);
+    if(ok && fr != FR_OK){
+        printf("netcap: failed to close \"%s\": %s\n", filename, f_errmsg(fr));
+        ok = false;
+    }
+
+    if(ok)
+        printf("netcap: wrote %ld frames to \"%s\"\n", held, filename);
+    return ok;
+}
@@ -5,6 +5,7 @@
 #include <timers.h>
 #include <cli.h>
 #include <net.h>
+#include <init.h>
 
 packet_sink_t *packet_sink_alloc(void)
 {
@@ -107,16 +108,57 @@ packet_t *packet_queue_pophead(packet_queue_t *q)
 }
 
 
+/* Packet buffers come from a fixed pool of PACKET_MAXLEN buffers threaded
+ * onto a free list, so allocating and freeing are O(1) and we avoid walking
+ * the heap for every frame. If the pool runs dry we fall back to malloc. */
+#define PACKET_POOL_STRIDE ((sizeof(packet_t) + PACKET_MAXLEN + 3) & ~3)
+
+static packet_t *packet_pool_free_list = NULL;
+static uint8_t *packet_pool_base = NULL;
+static uint8_t *packet_pool_end = NULL;
+int packet_pool_size = 0;
+
+void packet_pool_init(void)
+{
+    packet_t *p;
+
+    // don't let the pool take more than a quarter of the heap (KISS SRAM build has a tiny heap)
+    packet_pool_size = PACKET_POOL_SIZE;
+    if(packet_pool_size * PACKET_POOL_STRIDE > heap_size / 4)
+        packet_pool_size = (heap_size / 4) / PACKET_POOL_STRIDE;
+    if(packet_pool_size <= 0)
+        return;
+
+    packet_pool_base = malloc(packet_pool_size * PACKET_POOL_STRIDE);
+    packet_pool_end = packet_pool_base + packet_pool_size * PACKET_POOL_STRIDE;
+    packet_pool_free_list = NULL;
+
+    for(int i=packet_pool_size-1; i>=0; i--){
+        p = (packet_t*)(packet_pool_base + i * PACKET_POOL_STRIDE);
+        p->next = packet_pool_free_list;
+        packet_pool_free_list = p;
+    }
+}
+
 packet_t *packet_alloc(int data_size)
 {
+    packet_t *p;
+
     if(data_size >= PACKET_MAXLEN)
         printf("net: packet_alloc(%d): too big!\n", data_size);
 
+    if(packet_pool_free_list && data_size <= PACKET_MAXLEN){
+        p = packet_pool_free_list;
+        packet_pool_free_list = p->next;
+    }else{
+        packet_pool_exhausted_count++;
+        p = malloc(sizeof(packet_t) + data_size);
+    }
+
     packet_alive_count++;
-    if(packet_alive_count > 20)
-        printf("packet_alive_count=%ld\n", packet_alive_count);
+    if(packet_alive_count > packet_pool_high_water)
+        packet_pool_high_water = packet_alive_count;
 
-    packet_t *p=malloc(sizeof(packet_t) + data_size);
     memset(p, 0, sizeof(packet_t)); // do not zero out the data, just the header
     p->buffer_length_alloc = p->buffer_length = data_size;
     p->eth = (ethernet_header_t*)p->buffer;
@@ -131,6 +173,10 @@ void packet_set_destination_mac(packet_t *packet, const macaddr_t *mac)
 
 void packet_free(packet_t *packet)
 {
-    free(packet);
+    if((uint8_t*)packet >= packet_pool_base && (uint8_t*)packet < packet_pool_end){
+        packet->next = packet_pool_free_list;
+        packet_pool_free_list = packet;
+    }else
+        free(packet);
     packet_alive_count--;
 }
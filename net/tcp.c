@@ -0,0 +1,545 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <cli.h>
+#include <net.h>
+
+// documentation:
+// https://www.rfc-editor.org/rfc/rfc9293 - Transmission Control Protocol (TCP)
+// https://www.rfc-editor.org/rfc/rfc6298 - Computing TCP's Retransmission Timer
+
+// A small, polled, client-only TCP. Everything happens from net_pump():
+// received segments arrive through the connection's packet sink, and the
+// sink timer drives retransmission and TIME-WAIT. Received data is passed
+// straight to the owner's callback in sequence order, so we keep no receive
+// buffer and can always offer the full window, which is sized to fit in the
+// ethernet card's receive ring. Segments that arrive out of order are
+// dropped and answered with a duplicate ACK; the peer will retransmit.
+
+#define TCP_MSS              1460 // largest segment we send or accept (1500 byte MTU)
+#define TCP_TX_BUFFER        8192 // bytes of outgoing data we buffer
+#define TCP_RTO_INITIAL       500 // ms
+#define TCP_RTO_MAX          8000 // ms
+#define TCP_MAX_RETRIES        10 // retransmissions of one segment before we give up
+#define TCP_TIME_WAIT        1000 // ms; we use a fresh random port for each connection
+
+typedef enum {
+    tcp_state_closed,
+    tcp_state_syn_sent,
+    tcp_state_established,
+    tcp_state_fin_wait_1,
+    tcp_state_fin_wait_2,
+    tcp_state_closing,
+    tcp_state_time_wait,
+    tcp_state_close_wait,
+    tcp_state_last_ack,
+} tcp_state_t;
+
+struct tcp_connection_t {
+    packet_sink_t *sink;
+    tcp_state_t state;
+    const char *error;
+    tcp_data_cb_t data_cb;
+    void *data_cb_private;
+
+    // send sequence space
+    uint32_t iss;            // initial send sequence number
+    uint32_t snd_una;        // oldest unacknowledged
+    uint32_t snd_nxt;        // next to send
+    uint32_t snd_max;        // highest sequence sent; above snd_nxt after a retransmission timeout
+    uint32_t snd_wnd;        // peer's receive window, relative to snd_una
+    uint16_t snd_mss;        // peer's maximum segment size
+
+    // receive sequence space
+    uint32_t rcv_nxt;        // next we expect
+    uint16_t rcv_wnd;        // window we advertise
+
+    // outgoing data; tx_buffer[tx_start] holds the byte at sequence snd_una
+    uint8_t tx_buffer[TCP_TX_BUFFER];
+    int tx_start;
+    int tx_len;
+
+    bool fin_pending;        // tcp_close() called; send FIN after the data
+    bool fin_sent;
+    bool ack_pending;        // we owe the peer an ACK
+    int rto;                 // retransmission timeout, ms
+    int retries;
+};
+
+// sequence number comparisons, modulo 2^32
+#define SEQ_LT(a, b)  ((int32_t)((a) - (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t)((a) - (b)) <= 0)
+
+static uint16_t tcp_receive_window(void)
+{
+    // each full sized segment occupies this many bytes of the card's ring:
+    // the frame plus the card's 4 byte header, rounded up to 256 byte pages
+    int frame_bytes = ((sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(tcp_header_t) +
+                        TCP_MSS + 4 + 255) >> 8) << 8;
+    int frames = eth_rxbuffer_size() / frame_bytes;
+
+    if(frames < 1)
+        frames = 1;
+    return frames * TCP_MSS;
+}
+
+static void tcp_set_closed(tcp_connection_t *conn, const char *error)
+{
+    conn->state = tcp_state_closed;
+    conn->sink->timer = 0;
+    if(error && !conn->error)
+        conn->error = error;
+}
+
+static void tcp_start_timer(tcp_connection_t *conn)
+{
+    conn->sink->timer = set_timer_ms(conn->rto);
+}
+
+static void tcp_send_segment(tcp_connection_t *conn, uint8_t flags, uint32_t seq, int offset, int length)
+{
+    packet_t *packet;
+    int options = (flags & tcp_flag_syn) ? 4 : 0;
+    int pos, part;
+
+    packet = packet_create_for_sink(conn->sink, options + length);
+    packet->tcp->sequence = htonl(seq);
+    packet->tcp->flags = flags;
+    packet->tcp->window_size = htons(conn->rcv_wnd);
+    if(flags & tcp_flag_ack){
+        packet->tcp->ack = htonl(conn->rcv_nxt);
+        conn->ack_pending = false;
+    }else
+        packet->tcp->ack = 0;
+
+    if(options){
+        // maximum segment size option
+        packet->data[0] = 2;
+        packet->data[1] = 4;
+        packet->data[2] = TCP_MSS >> 8;
+        packet->data[3] = TCP_MSS & 0xff;
+        packet->tcp->data_offset = ((sizeof(tcp_header_t) + options) / 4) << 4;
+        packet->data += options;
+        packet->data_length -= options;
+    }
+
+    if(length){
+        // copy from the ring, which may wrap around
+        pos = (conn->tx_start + offset) % TCP_TX_BUFFER;
+        part = TCP_TX_BUFFER - pos;
+        if(part > length)
+            part = length;
+        memcpy(packet->data, conn->tx_buffer + pos, part);
+        memcpy(packet->data + part, conn->tx_buffer, length - part);
+    }
+
+    net_tx(packet);
+}
+
+static void tcp_send_ack(tcp_connection_t *conn)
+{
+    tcp_send_segment(conn, tcp_flag_ack, conn->snd_nxt, 0, 0);
+}
+
+// send whatever data (and FIN) the peer's window allows
+static void tcp_output(tcp_connection_t *conn, bool force)
+{
+    int offset, length;
+
+    if(conn->state != tcp_state_established && conn->state != tcp_state_close_wait &&
+       conn->state != tcp_state_fin_wait_1 && conn->state != tcp_state_closing &&
+       conn->state != tcp_state_last_ack)
+        return;
+
+    while(true){
+        offset = conn->snd_nxt - conn->snd_una; // bytes already in flight
+        if(conn->fin_sent || offset >= conn->tx_len)
+            break;
+        length = conn->tx_len - offset;
+        if(length > conn->snd_mss)
+            length = conn->snd_mss;
+        if(offset + length > conn->snd_wnd){
+            // window full; when forced (retransmission, or probing a zero
+            // window) we send one segment regardless
+            if(!force)
+                length = conn->snd_wnd - offset;
+            if(length <= 0)
+                break;
+        }
+        force = false;
+        tcp_send_segment(conn, tcp_flag_ack | tcp_flag_psh, conn->snd_nxt, offset, length);
+        conn->snd_nxt += length;
+        if(SEQ_LT(conn->snd_max, conn->snd_nxt))
+            conn->snd_max = conn->snd_nxt;
+    }
+
+    if(conn->fin_pending && !conn->fin_sent && conn->snd_nxt - conn->snd_una == conn->tx_len){
+        tcp_send_segment(conn, tcp_flag_ack | tcp_flag_fin, conn->snd_nxt, 0, 0);
+        conn->snd_nxt++;
+        if(SEQ_LT(conn->snd_max, conn->snd_nxt))
+            conn->snd_max = conn->snd_nxt;
+        conn->fin_sent = true;
+        if(conn->state == tcp_state_established)
+            conn->state = tcp_state_fin_wait_1;
+        else if(conn->state == tcp_state_close_wait)
+            conn->state = tcp_state_last_ack;
+    }
+
+    // with nothing in flight and the peer's window closed we run the timer
+    // as a persist timer; its forced send probes for the window to reopen
+    if(!conn->sink->timer && (conn->snd_nxt != conn->snd_una || (!conn->snd_wnd && conn->tx_len)))
+        tcp_start_timer(conn);
+}
+
+static void tcp_parse_options(tcp_connection_t *conn, packet_t *packet)
+{
+    uint8_t *opt = packet->tcp->options;
+    uint8_t *end = packet->data;
+    int mss;
+
+    while(opt < end && *opt != 0){ // 0 = end of option list
+        if(*opt == 1){ // no-op
+            opt++;
+            continue;
+        }
+        if(opt + 1 >= end || opt[1] < 2)
+            break;
+        if(*opt == 2 && opt[1] == 4){ // maximum segment size
+            mss = (opt[2] << 8) | opt[3];
+            if(mss > 0 && mss < conn->snd_mss)
+                conn->snd_mss = mss;
+        }
+        opt += opt[1];
+    }
+}
+
+static void tcp_process_ack(tcp_connection_t *conn, uint32_t ack, uint16_t window)
+{
+    uint32_t acked;
+
+    if(SEQ_LT(ack, conn->snd_una) || SEQ_LT(conn->snd_max, ack))
+        return; // old, or acknowledges something we never sent
+
+    acked = ack - conn->snd_una;
+    if(acked){
+        if(acked > conn->tx_len){
+            // this includes our FIN
+            conn->fin_sent = true; // even if we had gone back to resend it
+            conn->tx_start = (conn->tx_start + conn->tx_len) % TCP_TX_BUFFER;
+            conn->tx_len = 0;
+            switch(conn->state){
+                case tcp_state_fin_wait_1:
+                    conn->state = tcp_state_fin_wait_2;
+                    break;
+                case tcp_state_closing:
+                    conn->state = tcp_state_time_wait;
+                    conn->sink->timer = set_timer_ms(TCP_TIME_WAIT);
+                    break;
+                case tcp_state_last_ack:
+                    tcp_set_closed(conn, NULL);
+                    break;
+                default:
+                    break;
+            }
+        }else{
+            conn->tx_start = (conn->tx_start + acked) % TCP_TX_BUFFER;
+            conn->tx_len -= acked;
+        }
+        conn->snd_una = ack;
+        if(SEQ_LT(conn->snd_nxt, ack))
+            conn->snd_nxt = ack; // segments we went back to resend were delivered after all
+        conn->retries = 0;
+        conn->rto = TCP_RTO_INITIAL;
+        if(conn->state != tcp_state_time_wait)
+            conn->sink->timer = 0; // restarted by tcp_output() if there is more in flight
+    }
+
+    if(!window)
+        conn->retries = 0; // the peer answered a probe; it is alive, just full
+
+    conn->snd_wnd = window;
+}
+
+static void tcp_deliver(tcp_connection_t *conn, packet_t *packet)
+{
+    uint32_t seq = ntohl(packet->tcp->sequence);
+    uint8_t *data = packet->data;
+    int length = packet->data_length;
+    uint32_t skip;
+
+    if(length == 0)
+        return;
+
+    conn->ack_pending = true; // we always answer data, duplicates included
+
+    if(conn->state != tcp_state_established && conn->state != tcp_state_fin_wait_1 &&
+       conn->state != tcp_state_fin_wait_2)
+        return;
+
+    // trim anything we already have
+    if(SEQ_LT(seq, conn->rcv_nxt)){
+        skip = conn->rcv_nxt - seq;
+        if(skip >= length)
+            return;
+        data += skip;
+        length -= skip;
+        seq = conn->rcv_nxt;
+    }
+
+    if(seq != conn->rcv_nxt)
+        return; // a gap; drop it and our duplicate ACK will tell the peer
+
+    if(conn->data_cb && !conn->data_cb(conn->data_cb_private, data, length)){
+        tcp_abort(conn);
+        return;
+    }
+    conn->rcv_nxt += length;
+}
+
+static void tcp_packet_received(packet_sink_t *sink, packet_t *packet)
+{
+    tcp_connection_t *conn = sink->sink_private;
+    tcp_header_t *tcp = packet->tcp;
+    uint32_t seq = ntohl(tcp->sequence);
+    uint32_t ack = ntohl(tcp->ack);
+
+    switch(conn->state){
+        case tcp_state_closed:
+            break;
+
+        case tcp_state_syn_sent:
+            if((tcp->flags & tcp_flag_ack) && ack != conn->iss + 1)
+                break; // not for this connection attempt
+            if(tcp->flags & tcp_flag_rst){
+                if(tcp->flags & tcp_flag_ack)
+                    tcp_set_closed(conn, "connection refused");
+                break;
+            }
+            if((tcp->flags & (tcp_flag_syn | tcp_flag_ack)) == (tcp_flag_syn | tcp_flag_ack)){
+                conn->rcv_nxt = seq + 1;
+                conn->snd_una = ack;
+                conn->snd_wnd = ntohs(tcp->window_size);
+                conn->retries = 0;
+                conn->rto = TCP_RTO_INITIAL;
+                conn->sink->timer = 0;
+                tcp_parse_options(conn, packet);
+                conn->state = tcp_state_established;
+                conn->ack_pending = true;
+            }
+            break;
+
+        default: // synchronised states
+            if(tcp->flags & tcp_flag_rst){
+                // accept a reset only if it is within our receive window
+                if(SEQ_LEQ(conn->rcv_nxt, seq) && SEQ_LT(seq, conn->rcv_nxt + conn->rcv_wnd))
+                    tcp_set_closed(conn, "connection reset");
+                break;
+            }
+            if(tcp->flags & tcp_flag_syn){
+                conn->ack_pending = true; // retransmitted SYN-ACK: our ACK was lost
+                break;
+            }
+            if(tcp->flags & tcp_flag_ack)
+                tcp_process_ack(conn, ack, ntohs(tcp->window_size));
+            if(conn->state == tcp_state_closed)
+                break;
+
+            tcp_deliver(conn, packet);
+            if(conn->state == tcp_state_closed)
+                break;
+
+            // a FIN counts only once we have all the data before it
+            if((tcp->flags & tcp_flag_fin) && seq + packet->data_length == conn->rcv_nxt){
+                conn->rcv_nxt++;
+                conn->ack_pending = true;
+                switch(conn->state){
+                    case tcp_state_established:
+                        conn->state = tcp_state_close_wait;
+                        break;
+                    case tcp_state_fin_wait_1:
+                        conn->state = tcp_state_closing;
+                        break;
+                    case tcp_state_fin_wait_2:
+                        conn->state = tcp_state_time_wait;
+                        conn->sink->timer = set_timer_ms(TCP_TIME_WAIT);
+                        break;
+                    default:
+                        break;
+                }
+            }else if((tcp->flags & tcp_flag_fin) && conn->state == tcp_state_time_wait)
+                conn->ack_pending = true; // retransmitted FIN
+            break;
+    }
+
+    packet_free(packet);
+
+    if(conn->state == tcp_state_closed)
+        return;
+
+    // the window may have opened, so send what we can; this also carries any ACK we owe
+    tcp_output(conn, false);
+
+    // ACK only once we have processed every segment already queued: one
+    // cumulative ACK covers the lot
+    if(conn->ack_pending && !packet_queue_peekhead(&sink->queue))
+        tcp_send_ack(conn);
+}
+
+static void tcp_timer_expired(packet_sink_t *sink)
+{
+    tcp_connection_t *conn = sink->sink_private;
+
+    if(conn->state == tcp_state_time_wait){
+        tcp_set_closed(conn, NULL);
+        return;
+    }
+
+    if(conn->state == tcp_state_closed || (conn->snd_nxt == conn->snd_una && !conn->tx_len))
+        return; // nothing in flight, nor waiting for the window to open
+
+    if(++conn->retries > TCP_MAX_RETRIES){
+        tcp_set_closed(conn, conn->state == tcp_state_syn_sent ? "connection timed out" : "too many retransmissions");
+        return;
+    }
+
+    // back off, then go back and resend from the oldest unacknowledged byte
+    conn->rto *= 2;
+    if(conn->rto > TCP_RTO_MAX)
+        conn->rto = TCP_RTO_MAX;
+
+    if(conn->state == tcp_state_syn_sent){
+        tcp_send_segment(conn, tcp_flag_syn, conn->iss, 0, 0);
+    }else{
+        conn->snd_nxt = conn->snd_una;
+        conn->fin_sent = false; // tcp_output() resends any FIN after the data
+        tcp_output(conn, true);
+    }
+    tcp_start_timer(conn);
+}
+
+tcp_connection_t *tcp_connect(uint32_t remote_ip, uint16_t remote_port, tcp_data_cb_t data_cb, void *data_cb_private)
+{
+    tcp_connection_t *conn;
+
+    if(!interface_ipv4_address){
+        printf("tcp: no ipv4 address!\n");
+        return NULL;
+    }
+
+    conn = malloc_unchecked(sizeof(tcp_connection_t));
+    if(!conn){
+        printf("tcp: out of memory\n");
+        return NULL;
+    }
+    memset(conn, 0, sizeof(tcp_connection_t));
+
+    conn->data_cb = data_cb;
+    conn->data_cb_private = data_cb_private;
+    conn->iss = (gogoboot_read_timer() << 16) ^ (uint32_t)conn;
+    conn->snd_una = conn->iss;
+    conn->snd_nxt = conn->iss + 1; // our SYN
+    conn->snd_max = conn->snd_nxt;
+    conn->snd_mss = TCP_MSS;
+    conn->rcv_wnd = tcp_receive_window();
+    conn->rto = TCP_RTO_INITIAL;
+    conn->state = tcp_state_syn_sent;
+
+    conn->sink = packet_sink_alloc();
+    conn->sink->match_interface_local_ip = true;
+    conn->sink->match_ipv4_protocol = ip_proto_tcp;
+    conn->sink->match_remote_ip = remote_ip;
+    conn->sink->match_remote_port = remote_port;
+    conn->sink->match_local_port = 49152 + (gogoboot_read_timer() & 0x3fff);
+    conn->sink->sink_private = conn;
+    conn->sink->cb_packet_received = tcp_packet_received;
+    conn->sink->cb_timer_expired = tcp_timer_expired;
+    net_add_packet_sink(conn->sink);
+
+    tcp_send_segment(conn, tcp_flag_syn, conn->iss, 0, 0);
+    tcp_start_timer(conn);
+
+    return conn;
+}
+
+int tcp_send(tcp_connection_t *conn, const void *data, int length)
+{
+    const uint8_t *src = data;
+    int space, pos, part;
+
+    if(conn->state != tcp_state_established && conn->state != tcp_state_close_wait &&
+       conn->state != tcp_state_syn_sent)
+        return 0;
+    if(conn->fin_pending)
+        return 0;
+
+    space = TCP_TX_BUFFER - conn->tx_len;
+    if(length > space)
+        length = space;
+
+    pos = (conn->tx_start + conn->tx_len) % TCP_TX_BUFFER;
+    part = TCP_TX_BUFFER - pos;
+    if(part > length)
+        part = length;
+    memcpy(conn->tx_buffer + pos, src, part);
+    memcpy(conn->tx_buffer, src + part, length - part);
+    conn->tx_len += length;
+
+    tcp_output(conn, false);
+
+    return length;
+}
+
+int tcp_send_pending(tcp_connection_t *conn)
+{
+    return conn->tx_len;
+}
+
+void tcp_close(tcp_connection_t *conn)
+{
+    if(conn->state == tcp_state_syn_sent){
+        tcp_abort(conn);
+        return;
+    }
+    conn->fin_pending = true;
+    tcp_output(conn, false);
+}
+
+void tcp_abort(tcp_connection_t *conn)
+{
+    if(conn->state != tcp_state_closed && conn->state != tcp_state_syn_sent &&
+       conn->state != tcp_state_time_wait)
+        tcp_send_segment(conn, tcp_flag_rst | tcp_flag_ack, conn->snd_nxt, 0, 0);
+    tcp_set_closed(conn, "connection aborted");
+}
+
+void tcp_free(tcp_connection_t *conn)
+{
+    if(conn->state != tcp_state_closed && conn->state != tcp_state_time_wait)
+        tcp_abort(conn);
+    net_remove_packet_sink(conn->sink);
+    packet_sink_free(conn->sink);
+    free(conn);
+}
+
+bool tcp_established(tcp_connection_t *conn)
+{
+    return conn->state == tcp_state_established || conn->state == tcp_state_close_wait;
+}
+
+bool tcp_remote_closed(tcp_connection_t *conn)
+{
+    return conn->state != tcp_state_syn_sent && conn->state != tcp_state_established &&
+           conn->state != tcp_state_fin_wait_1 && conn->state != tcp_state_fin_wait_2;
+}
+
+bool tcp_closed(tcp_connection_t *conn)
+{
+    return conn->state == tcp_state_closed || conn->state == tcp_state_time_wait;
+}
+
+const char *tcp_error(tcp_connection_t *conn)
+{
+    return conn->error;
+}
@@ -11,16 +11,40 @@
 // https://www.rfc-editor.org/rfc/rfc2347 - TFTP Option Extension
 // https://www.rfc-editor.org/rfc/rfc2349 - TFTP Timeout Interval and Transfer Size Options
 // https://www.rfc-editor.org/rfc/rfc7440 - TFTP Windowsize Option
+// https://www.rfc-editor.org/rfc/rfc2090 - TFTP Multicast Option
 // https://www.compuphase.com/tftp.htm - Extending TFTP
 
 #define REQUEST_TIMEOUT 1500 // ms
 #define DATA_TIMEOUT     250 // ms
 
+#define TFTP_MAX_BLOCK_SIZE 1468 // largest block that fits a 1500 byte MTU after IPv4, UDP, TFTP headers
+#define TFTP_MAX_WINDOW        8 // largest window we will offer
+#define TFTP_GROW_AFTER        8 // clean windows before we offer a larger window again
+#define TFTP_WRITE_BUFFER     32 // KB, default size of the write coalescing buffer for gets to disk
+#define TFTP_PREFETCH_WINDOWS  4 // windows of file data to read ahead for puts
+#define TFTP_PREFETCH_CHUNK 4096 // bytes read from disk per step while waiting for ACKs
+
+// Adaptive ceiling on the window size we offer. RFC 7440 fixes the window
+// once the server acknowledges the options, so this carries what we learn
+// (timeouts and lost blocks shrink it, runs of clean windows grow it) from
+// one transfer into the negotiation of the next.
+static int tftp_window_limit = TFTP_MAX_WINDOW;
+
+net_histogram_t tftp_ack_rtt_histogram;
+
 typedef struct tftp_transfer_t tftp_transfer_t;
 
+typedef struct {
+    uint32_t load_address;
+    uint32_t load_size;
+    bool reserved;
+} tftp_memory_target_t;
+
 struct tftp_transfer_t {
     packet_queue_t data_queue;
     FIL disk_file;
+    tftp_data_cb_t data_cb;   // when set, received data is passed here instead of written to disk_file
+    void *data_cb_private;
     bool is_put;
     char *tftp_filename;
     char *disk_filename;
@@ -34,8 +58,34 @@ struct tftp_transfer_t {
     bool started;
     bool completed;
     bool success;
+    bool failed;
     int timeouts;
     int retransmits_this_block;
+    int out_of_order;
+    int clean_windows;
+    bool gap_acked;           // we have acknowledged the last block before a gap; waiting for the resend
+    write_buffer_t write_buffer; // received data is collected here and written to disk_file in whole clusters
+    int windows;              // number of windows acknowledged
+    uint8_t *prefetch_ring;   // circular buffer of file data read ahead of the window for puts
+    int prefetch_size;        // multiple of TFTP_PREFETCH_CHUNK
+    int prefetch_end;         // file offset up to which data is in the ring; it starts at bytes_transferred
+    packet_sink_t *sink;      // our unicast sink, talking to the server's transfer port
+    bool mc_requested;        // we asked for the multicast option
+    bool multicast;           // the server put us in a multicast session
+    bool mc_master;           // the server takes ACKs from us; other clients just listen
+    uint32_t mc_group;
+    packet_sink_t *mc_sink;   // receives the blocks sent to the group
+    uint8_t *mc_bitmap;       // one bit per block received, since blocks arrive in any order
+    int mc_blocks;            // blocks in the file
+    int mc_received;          // blocks received so far
+    int mc_next;              // lowest numbered block we still need
+    tftp_memory_target_t *memory; // set by tftp_load(); lets the driver receive blocks in place
+    uint32_t blocks_received; // blocks accepted in order so far
+    int direct_blocks;        // blocks the driver put in place for us
+    uint32_t direct_base;     // value of blocks_received that direct_placed is relative to
+    uint32_t direct_placed;   // bit n set once the block n after direct_base has been placed
+    timer_t rtt_start;        // when we sent the ACK or window we are timing
+    bool rtt_pending;         // no sample after a retransmission (Karn's algorithm)
 };
 
 typedef struct tftp_header_t tftp_header_t;
@@ -65,6 +115,8 @@ static const uint16_t tftp_op_ack = 4;
 static const uint16_t tftp_op_err = 5;
 static const uint16_t tftp_op_options_ack = 6;
 
+static const uint16_t tftp_err_options = 8; // RFC 2347: terminate the transfer during option negotiation
+
 static uint16_t expected_block_number(tftp_transfer_t *tftp, int count)
 {
     int expected_block;
@@ -94,30 +146,61 @@ static int options_append(char *options, int offset, char *extra)
     return offset + extra_len;
 }
 
+static int options_append_int(char *options, int offset, uint32_t n)
+{
+    char buffer[12];
+    char *t = buffer+sizeof(buffer);
+
+    *--t = 0;
+    do {
+        *--t = (n % 10)+'0';
+        n/=10;
+    } while(n);
+
+    return options_append(options, offset, t);
+}
+
+static void tftp_window_shrink(tftp_transfer_t *tftp)
+{
+    tftp->clean_windows = 0;
+    tftp_window_limit /= 2;
+    if(tftp_window_limit < 1)
+        tftp_window_limit = 1;
+}
+
+static void tftp_window_clean(tftp_transfer_t *tftp)
+{
+    if(++tftp->clean_windows >= TFTP_GROW_AFTER){
+        tftp->clean_windows = 0;
+        if(tftp_window_limit < TFTP_MAX_WINDOW)
+            tftp_window_limit++;
+    }
+}
+
 static packet_t *tftp_create_request(packet_sink_t *sink)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     char options[MAXOPT];
     int offset = 0;
-    int windowsize;
-    char wsize[2];
+    int windowsize, frame_pages;
 
-    /* when receiving, try to avoid overflowing ethernet device receive buffer */
-    /* no issue on transmit path */
-    /* 5 * 256 = 1280 bytes; allows 1024 byte payload + up to 210 headers etc */
+    /* when receiving, avoid overflowing the ethernet device receive ring: a
+     * whole window of full sized blocks must fit in the pages that are free
+     * right now. each block arrives as one frame plus the card's 4 byte
+     * header, rounded up to 256 byte pages. no issue on transmit path. */
     if(tftp->is_put)
-        windowsize = 8;
-    else
-        windowsize = eth_rxbuffer_size() / (256 * 5); 
+        windowsize = TFTP_MAX_WINDOW;
+    else{
+        frame_pages = (sizeof(ethernet_header_t) + sizeof(ipv4_header_t) + sizeof(udp_header_t) +
+                       4 + TFTP_MAX_BLOCK_SIZE + 4 + 255) >> 8;
+        windowsize = (eth_rxbuffer_free() >> 8) / frame_pages;
+    }
 
-    if(windowsize > 8) /* 8 works really well */
-        windowsize = 8;
+    if(windowsize > tftp_window_limit)
+        windowsize = tftp_window_limit;
     if(windowsize < 1) /* need at least 1 */
         windowsize = 1;
 
-    wsize[0] = '0' + windowsize;
-    wsize[1] = 0;
-
     offset = options_append(options, offset, tftp->tftp_filename);
     offset = options_append(options, offset, "octet");
 
@@ -125,26 +208,20 @@ static packet_t *tftp_create_request(packet_sink_t *sink)
     offset = options_append(options, offset, "0");
 
     offset = options_append(options, offset, "tsize");
-    if(tftp->is_put){
-        uint32_t n = tftp->total_size;
-        char sizebuf[12];
-        char *t = sizebuf+sizeof(sizebuf);  
-        *--t = 0; 
-        do { 
-            *--t = (n % 10)+'0'; 
-            n/=10; 
-        } while(n);
-        offset = options_append(options, offset, t);
-    }else{
-        /* get request: 0 = please tell me total file size */
-        offset = options_append(options, offset, "0");
-    }
+    /* get request: 0 = please tell me total file size */
+    offset = options_append_int(options, offset, tftp->is_put ? tftp->total_size : 0);
 
     offset = options_append(options, offset, "blksize");
-    offset = options_append(options, offset, "1024");
+    offset = options_append_int(options, offset, TFTP_MAX_BLOCK_SIZE);
 
-    offset = options_append(options, offset, "windowsize");
-    offset = options_append(options, offset, wsize);
+    if(tftp->mc_requested){
+        // windowsize is not defined for multicast sessions, so we ask for one or the other
+        offset = options_append(options, offset, "multicast");
+        offset = options_append(options, offset, "");
+    }else{
+        offset = options_append(options, offset, "windowsize");
+        offset = options_append_int(options, offset, windowsize);
+    }
 
     packet_t *packet = packet_create_for_sink(sink, offset + 2);
     packet->udp->destination_port = htons(69); // RRQ/WRQ always goes to server port 69
@@ -182,23 +259,102 @@ static packet_t *tftp_create_data(packet_sink_t *sink, uint16_t block_number)
     return packet;
 }
 
+// read the next chunk of the file into the ring, if there is space
+static bool tftp_put_prefetch(tftp_transfer_t *tftp)
+{
+    int pos, chunk;
+    FRESULT fr;
+    UINT size;
+
+    if(tftp->prefetch_end >= tftp->total_size)
+        return true; // we have the whole file
+
+    pos = tftp->prefetch_end % tftp->prefetch_size;
+    chunk = tftp->prefetch_size - (tftp->prefetch_end - tftp->bytes_transferred); // free space
+    if(chunk > TFTP_PREFETCH_CHUNK - (pos % TFTP_PREFETCH_CHUNK)) // never wraps
+        chunk = TFTP_PREFETCH_CHUNK - (pos % TFTP_PREFETCH_CHUNK);
+    if(chunk <= 0)
+        return true; // ring full
+
+    fr = f_read(&tftp->disk_file, tftp->prefetch_ring + pos, chunk, &size);
+    if(fr != FR_OK){
+        printf("tftp: failed to read from \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+        return false;
+    }
+    if(size < chunk) // file is shorter than it was when we opened it
+        tftp->total_size = tftp->prefetch_end + size;
+    tftp->prefetch_end += size;
+
+    return true;
+}
+
+static bool tftp_put_read_block(tftp_transfer_t *tftp, int offset, uint8_t *dest, UINT *size)
+{
+    FRESULT fr;
+    int pos, len, part;
+
+    if(!tftp->prefetch_ring){
+        fr = f_read(&tftp->disk_file, dest, tftp->block_size, size);
+        if(fr != FR_OK){
+            printf("tftp: failed to read from \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+            return false;
+        }
+        return true;
+    }
+
+    // normally the data was read while we waited for the ACK
+    while(tftp->prefetch_end < offset + tftp->block_size && tftp->prefetch_end < tftp->total_size)
+        if(!tftp_put_prefetch(tftp))
+            return false;
+
+    len = tftp->total_size - offset;
+    if(len > tftp->block_size)
+        len = tftp->block_size;
+    if(len < 0)
+        len = 0;
+
+    pos = offset % tftp->prefetch_size;
+    part = tftp->prefetch_size - pos;
+    if(part > len)
+        part = len;
+    memcpy(dest, tftp->prefetch_ring + pos, part);
+    memcpy(dest + part, tftp->prefetch_ring, len - part);
+
+    *size = len;
+    return true;
+}
+
+static void tftp_rtt_start(tftp_transfer_t *tftp)
+{
+    tftp->rtt_start = gogoboot_read_timer();
+    tftp->rtt_pending = true;
+}
+
+static void tftp_rtt_sample(tftp_transfer_t *tftp)
+{
+    if(tftp->rtt_pending){
+        net_histogram_add(&tftp_ack_rtt_histogram, gogoboot_read_timer() - tftp->rtt_start);
+        tftp->rtt_pending = false;
+    }
+}
+
 static void tftp_put_send_data(packet_sink_t *sink, int count)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     bool last_block = false;
     packet_t *packet;
     tftp_header_t *message;
-    FRESULT fr;
     UINT size;
 
-    f_lseek(&tftp->disk_file, tftp->bytes_transferred);
+    // retransmissions come from the ring too, so only seek without one
+    if(!tftp->prefetch_ring)
+        f_lseek(&tftp->disk_file, tftp->bytes_transferred);
 
     for(int n=0; !last_block && n < count; n++){
         packet = tftp_create_data(sink, expected_block_number(tftp, n + 1));
         message = (tftp_header_t*)packet->data;
-        fr = f_read(&tftp->disk_file, message->payload.data.data, tftp->block_size, &size);
-        if(fr != FR_OK){
-            printf("tftp: failed to read from \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+        if(!tftp_put_read_block(tftp, tftp->bytes_transferred + n * tftp->block_size,
+                    message->payload.data.data, &size)){
             tftp->completed = true;
             tftp->success = false;
             packet_free(packet);
@@ -216,6 +372,7 @@ static void tftp_put_send_data(packet_sink_t *sink, int count)
     }
 
     sink->timer = set_timer_ms(DATA_TIMEOUT);
+    tftp_rtt_start(tftp);
 }
 
 static void tftp_put_process_ack(packet_sink_t *sink, packet_t *packet)
@@ -244,10 +401,17 @@ static void tftp_put_process_ack(packet_sink_t *sink, packet_t *packet)
     tftp->bytes_transferred += ((int)tftp->block_size * (int)blocks_transferred);
 
     if(tftp->bytes_transferred > tftp->total_size){ /* note > is correct here */
-        // we're done!
+        // we're done! the last window is usually short, so this is not a loss
         tftp->completed = true;
         tftp->success = true;
     }else{
+        if(blocks_transferred == tftp->window_size)
+            tftp_window_clean(tftp);
+        else if(blocks_transferred > 0){
+            // the server acknowledged part of the window: a block went missing
+            tftp->out_of_order++;
+            tftp_window_shrink(tftp);
+        }
         // send more
         tftp_put_send_data(sink, (blocks_transferred == tftp->window_size) ? tftp->window_size : 1);
     }
@@ -257,12 +421,206 @@ static void tftp_get_send_ack(packet_sink_t *sink)
 {
     net_tx(tftp_create_ack(sink));
     sink->timer = set_timer_ms(DATA_TIMEOUT);
+    tftp_rtt_start(sink->sink_private);
+}
+
+static void tftp_multicast_packet_received(packet_sink_t *sink, packet_t *packet);
+
+static void tftp_multicast_send_ack(packet_sink_t *sink)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+
+    // acknowledging the block before the first one we lack asks the server
+    // to carry on from there; once we have everything, this is the last block
+    tftp->last_block = tftp->mc_next - 1;
+    tftp_get_send_ack(sink);
+}
+
+static void tftp_send_error(packet_sink_t *sink, uint16_t error_code, const char *error_message)
+{
+    int len = strlen(error_message) + 1;
+    packet_t *packet = packet_create_for_sink(sink, 4 + len);
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    message->opcode = htons(tftp_op_err);
+    message->payload.error.error_code = htons(error_code);
+    memcpy(message->payload.error.error_message, error_message, len);
+    net_tx(packet);
+}
+
+// turn down the session the server offered and ask again without the
+// multicast option, from a fresh port so nothing from the old session
+// reaches us
+static void tftp_multicast_decline(packet_sink_t *sink, const char *reason)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+
+    printf("tftp: %s, falling back to unicast\n", reason);
+    tftp_send_error(sink, tftp_err_options, reason);
+
+    net_remove_packet_sink(sink);
+    sink->match_remote_port = 0;
+    sink->match_local_port = 8192 + ((sink->match_local_port - 8192 + 1) & 0x7fff);
+    net_add_packet_sink(sink);
+
+    tftp->started = false;
+    tftp->mc_requested = false;
+    tftp->block_size = 512;
+    tftp->window_size = 1;
+    tftp->total_size = 0;
+    sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+    net_tx(tftp_create_request(sink));
+}
+
+// The multicast option value is "addr,port,mc". The first OACK names the
+// group; later ones (which promote us to master) may leave addr and port
+// empty.
+static void tftp_multicast_options(packet_sink_t *sink, const char *value)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    char addr[16];
+    const char *port, *mc;
+    uint32_t group;
+    int len;
+
+    port = strchr(value, ',');
+    mc = port ? strchr(port+1, ',') : NULL;
+    if(!mc){
+        printf("tftp: bad multicast option \"%s\"\n", value);
+        goto fail;
+    }
+
+    if(!tftp->multicast){
+        // the size tells us how many blocks to collect
+        if(!tftp->total_size){
+            tftp_multicast_decline(sink, "multicast needs the file size");
+            return;
+        }
+
+        len = port - value;
+        if(len <= 0 || len >= sizeof(addr)){
+            printf("tftp: no multicast group given\n");
+            goto fail;
+        }
+        memcpy(addr, value, len);
+        addr[len] = 0;
+        group = net_parse_ipv4(addr);
+        if(!net_ipv4_is_multicast(group)){
+            printf("tftp: bad multicast group \"%s\"\n", addr);
+            goto fail;
+        }
+
+        // blocks are numbered from 1 and the final block is always short,
+        // possibly empty; without rollover we can track at most 65535
+        tftp->mc_blocks = tftp->total_size / tftp->block_size + 1;
+        if(tftp->mc_blocks > 65535){
+            printf("tftp: file too large for a multicast transfer\n");
+            goto fail;
+        }
+        tftp->mc_bitmap = malloc_unchecked(tftp->mc_blocks / 8 + 1);
+        if(!tftp->mc_bitmap){
+            printf("tftp: out of memory\n");
+            goto fail;
+        }
+        memset(tftp->mc_bitmap, 0, tftp->mc_blocks / 8 + 1);
+        tftp->mc_next = 1;
+
+        // blocks land wherever they belong in the file, so there is
+        // nothing for the write buffer to coalesce
+        write_buffer_free(&tftp->write_buffer);
+
+        if(!net_multicast_join(group))
+            goto fail;
+        tftp->mc_group = group;
+        tftp->mc_sink = packet_sink_alloc();
+        tftp->mc_sink->match_ipv4_protocol = ip_proto_udp;
+        tftp->mc_sink->match_local_ip = group;
+        tftp->mc_sink->match_local_port = strtoul(port+1, NULL, 10);
+        tftp->mc_sink->match_remote_ip = sink->match_remote_ip;
+        tftp->mc_sink->sink_private = sink;
+        tftp->mc_sink->cb_packet_received = tftp_multicast_packet_received;
+        net_add_packet_sink(tftp->mc_sink);
+        tftp->multicast = true;
+    }
+
+    tftp->mc_master = (mc[1] == '1');
+    tftp->window_size = 1;
+    tftp->retransmits_this_block = 0;
+
+    if(tftp->mc_master)
+        tftp_multicast_send_ack(sink); // agree to the options, or pick up where the last master stopped
+    else
+        sink->timer = set_timer_ms(REQUEST_TIMEOUT); // wait our turn
+    return;
+
+fail:
+    tftp->completed = true;
+    tftp->success = false;
+}
+
+static void tftp_multicast_process_data(packet_sink_t *sink, packet_t *packet)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+    int block = ntohs(message->payload.data.block_number);
+    int size = packet->data_length - 4;
+    uint32_t offset;
+
+    if(tftp->completed)
+        return;
+
+    if(block >= 1 && block <= tftp->mc_blocks && !(tftp->mc_bitmap[block >> 3] & (1 << (block & 7)))){
+        offset = (block - 1) * tftp->block_size;
+        if(tftp->data_cb){
+            if(!tftp->data_cb(tftp->data_cb_private, offset, message->payload.data.data, size, tftp->total_size))
+                goto fail;
+        }else if(f_lseek(&tftp->disk_file, offset) != FR_OK ||
+                 !write_buffer_write_file(&tftp->write_buffer, message->payload.data.data, size))
+            goto fail;
+
+        tftp->mc_bitmap[block >> 3] |= 1 << (block & 7);
+        tftp->mc_received++;
+        tftp->bytes_transferred += size;
+        if(block == tftp->mc_next){
+            tftp->retransmits_this_block = 0;
+            while(tftp->mc_next <= tftp->mc_blocks && (tftp->mc_bitmap[tftp->mc_next >> 3] & (1 << (tftp->mc_next & 7))))
+                tftp->mc_next++;
+        }else
+            tftp->out_of_order++;
+    }
+
+    if(tftp->mc_received == tftp->mc_blocks){
+        tftp->completed = true;
+        tftp->success = true;
+    }
+
+    if(tftp->mc_master)
+        tftp_multicast_send_ack(sink);
+    else if(!tftp->completed)
+        sink->timer = set_timer_ms(REQUEST_TIMEOUT);
+    return;
+
+fail:
+    tftp->completed = true;
+    tftp->success = false;
+}
+
+static void tftp_multicast_packet_received(packet_sink_t *mc_sink, packet_t *packet)
+{
+    packet_sink_t *sink = mc_sink->sink_private;
+    tftp_header_t *message = (tftp_header_t*)packet->data;
+
+    if(packet->data_length >= 4 && ntohs(message->opcode) == tftp_op_data)
+        tftp_multicast_process_data(sink, packet);
+
+    packet_free(packet);
 }
 
 static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message, int message_len)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     char *opt, *val, *ptr, *end;
+    char *mc_option = NULL;
     int val_int;
 
     // message->opcode has been confirmed to be tftp_op_options_ack already
@@ -298,13 +656,27 @@ static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message
             tftp->block_size = val_int;
         }else if(!strcmp(opt, "windowsize")){
             tftp->window_size = val_int;
+        }else if(!strcmp(opt, "multicast") && tftp->mc_requested){
+            mc_option = val;
+            printf(" %s=%s", opt, val);
+            continue;
         }
         printf(" %s=%d", opt, val_int);
     }
 
     putchar('\n');
 
+    if(mc_option){
+        tftp_multicast_options(sink, mc_option);
+        return;
+    }
+
     if(tftp->is_put){
+        if(tftp->prefetch_ring && tftp->prefetch_size < tftp->window_size * tftp->block_size){
+            // too small to hold a whole window; read from the file directly
+            free(tftp->prefetch_ring);
+            tftp->prefetch_ring = NULL;
+        }
         // for sending files, send our first DATA packets to agree to the options
         tftp_put_send_data(sink, tftp->window_size);
     }else{
@@ -313,33 +685,51 @@ static void tftp_process_options_ack(packet_sink_t *sink, tftp_header_t *message
     }
 }
 
+static bool tftp_get_write_data(tftp_transfer_t *tftp, const void *data, int size)
+{
+    if(tftp->data_cb){
+        if(!tftp->data_cb(tftp->data_cb_private, tftp->bytes_transferred, data, size, tftp->total_size))
+            return false;
+    }else if(!write_buffer_write(&tftp->write_buffer, data, size))
+        return false;
+
+    tftp->bytes_transferred += size;
+    return true;
+}
+
 static void tftp_get_flush_data_and_ack(packet_sink_t *sink)
 {
     tftp_transfer_t *tftp = sink->sink_private;
     packet_t *packet;
     tftp_header_t *message;
+    const uint8_t *data;
     int size;
-    FRESULT fr;
 
     // send this FIRST so we can overlap receiving more data with writing to disk
     tftp_get_send_ack(sink);
+    tftp->windows++;
 
-    // then flush any buffered packets to file on disk
+    // then flush any buffered packets to file on disk (or to memory)
     while((packet = packet_queue_pophead(&tftp->data_queue))){
         message = (tftp_header_t*)packet->data;
         size = packet->data_length - 4;
+        data = (packet->flags & packet_flag_rx_direct) ? packet->rx_direct : message->payload.data.data;
 
-        if(size > 0){
-            fr = f_write(&tftp->disk_file, message->payload.data.data, size, NULL);
-            tftp->bytes_transferred += size;
-            if(fr != FR_OK){
-                printf("tftp: failed to write to \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
+        if(size > 0 && !tftp->failed){
+            if(!tftp_get_write_data(tftp, data, size)){
+                tftp->failed = true;
                 tftp->completed = true;
                 tftp->success = false;
             }
         }
         packet_free(packet);
     }
+
+    // write out whatever remains once we have the final block
+    if(tftp->completed && tftp->success && !tftp->failed && !write_buffer_flush(&tftp->write_buffer)){
+        tftp->failed = true;
+        tftp->success = false;
+    }
 }
 
 static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
@@ -355,7 +745,11 @@ static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
 
     if(rxblock == expected_block_number(tftp, 1)){ // is it the block we are expecting?
         tftp->last_block = rxblock;
+        tftp->blocks_received++;
+        if(packet->flags & packet_flag_rx_direct)
+            tftp->direct_blocks++;
         tftp->retransmits_this_block = 0;
+        tftp->gap_acked = false;
 
         packet_queue_addtail(&tftp->data_queue, packet);
         free_packet = false;
@@ -366,14 +760,71 @@ static bool tftp_get_process_data(packet_sink_t *sink, packet_t *packet)
             tftp->success = true;
             tftp_get_flush_data_and_ack(sink);
         }
+    }else if(!tftp->completed){
+        tftp->out_of_order++;
+        // a block from further on in the window means the one we wanted was
+        // lost; acknowledge what we have right away so the server restarts
+        // the window from there, rather than waiting for our timer to expire
+        for(int n=2; n<=tftp->window_size; n++){
+            if(rxblock == expected_block_number(tftp, n)){
+                if(!tftp->gap_acked){
+                    tftp->gap_acked = true;
+                    tftp_window_shrink(tftp);
+                    tftp_get_flush_data_and_ack(sink);
+                }
+                break;
+            }
+        }
     }
 
-    if(tftp->last_block == ((tftp->last_ack + tftp->window_size) & 0xffff))
+    if(tftp->last_block == ((tftp->last_ack + tftp->window_size) & 0xffff)){
+        tftp_window_clean(tftp);
         tftp_get_flush_data_and_ack(sink);
+    }
 
     return free_packet;
 }
 
+/* Receive hint for tftp_load(), called from the driver with the TFTP header
+   of a datagram from the server. A data block that falls in the current
+   window goes straight to its place in the target memory; anything else is
+   received into a packet buffer as usual. Until the packet reaches us that
+   memory holds nothing we have accepted, so a block that turns out to be
+   bad does no harm: its resend is received into a packet buffer. Each
+   block is placed only once, because a duplicate could otherwise overwrite
+   it while the good copy waits in our queue, and then fail its checksum.
+   We wait until the whole file is reserved, since growing the bounce
+   buffer would move it under blocks that are still in the queue. */
+static uint8_t *tftp_rx_direct(packet_sink_t *sink, const uint8_t *header, int length)
+{
+    tftp_transfer_t *tftp = sink->sink_private;
+    const tftp_header_t *message = (const tftp_header_t*)header;
+    uint16_t rxblock;
+    uint32_t offset, shift;
+
+    if(tftp->multicast || tftp->completed || !tftp->memory->reserved ||
+       ntohs(message->opcode) != tftp_op_data || length > tftp->block_size)
+        return NULL;
+
+    // slide the bitmap along past the blocks accepted since we last looked
+    shift = tftp->blocks_received - tftp->direct_base;
+    tftp->direct_placed = (shift < 32) ? (tftp->direct_placed >> shift) : 0;
+    tftp->direct_base = tftp->blocks_received;
+
+    rxblock = ntohs(message->payload.data.block_number);
+    for(int n=1; n<=tftp->window_size && n<=32; n++){
+        if(rxblock == expected_block_number(tftp, n)){
+            if(tftp->direct_placed & (1 << (n-1)))
+                return NULL; // a repeat; the first copy may still be in the queue
+            tftp->direct_placed |= 1 << (n-1);
+            offset = (tftp->blocks_received + n - 1) * tftp->block_size;
+            return load_data_pointer(tftp->memory->load_address + offset, length);
+        }
+    }
+
+    return NULL;
+}
+
 static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
 {
     bool free_packet = true;
@@ -385,6 +836,8 @@ static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
         net_remove_packet_sink(sink);
         sink->match_remote_port = ntohs(packet->udp->source_port);
         net_add_packet_sink(sink);
+        if(sink->cb_rx_direct)
+            net_set_rx_direct_sink(sink);
         printf("tftp: server using port %d\n", sink->match_remote_port);
         tftp->started = true;
     }
@@ -394,14 +847,18 @@ static void tftp_client_packet_received(packet_sink_t *sink, packet_t *packet)
             tftp_process_options_ack(sink, message, packet->data_length);
             break;
         case tftp_op_ack:
+            tftp_rtt_sample(tftp);
             if(tftp->is_put)
                 tftp_put_process_ack(sink, packet);
             else
                 printf("tftp: unexpected ACK packet during get?\n");
             break;
         case tftp_op_data:
+            tftp_rtt_sample(tftp);
             if(tftp->is_put)
                 printf("tftp: unexpected DATA packet during put?\n");
+            else if(tftp->multicast)
+                tftp_multicast_process_data(sink, packet);
             else
                 free_packet = tftp_get_process_data(sink, packet);
             break;
@@ -440,120 +897,287 @@ static void tftp_client_timer_expired(packet_sink_t *sink)
     if(!tftp->started){
         sink->timer = set_timer_ms(REQUEST_TIMEOUT);
         net_tx(tftp_create_request(sink));
+    }else if(tftp->multicast){
+        // the master asks again for what it lacks; other clients keep
+        // listening until the server promotes them
+        if(tftp->mc_master)
+            tftp_multicast_send_ack(sink);
+        else
+            sink->timer = set_timer_ms(REQUEST_TIMEOUT);
     }else{
+        tftp_window_shrink(tftp);
         if(tftp->is_put)
             tftp_put_send_data(sink, 1);
         else
             tftp_get_flush_data_and_ack(sink);
     }
 
+    tftp->rtt_pending = false;
     tftp->timeouts++;
     tftp->retransmits_this_block++;
 }
 
-bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, 
-        const char *disk_filename, bool is_put)
+static tftp_transfer_t *tftp_alloc(const char *tftp_filename, const char *disk_filename, bool is_put)
 {
-    FRESULT fr;
-    uint32_t start, taken, rate;
-    int uart_byte, reported_transferred;
-    packet_sink_t *sink = packet_sink_alloc();
     tftp_transfer_t *tftp = malloc(sizeof(tftp_transfer_t));
     memset(tftp, 0, sizeof(tftp_transfer_t));
     packet_queue_init(&tftp->data_queue);
 
-    sink->match_interface_local_ip = true;
-    sink->match_ipv4_protocol = ip_proto_udp;
-    sink->match_remote_ip = tftp_server_ip;
-    sink->match_local_port = 8192 + (gogoboot_read_timer() & 0x7fff);
-    sink->sink_private = tftp;
     tftp->last_block = 0;
     tftp->block_size = 512;
     tftp->window_size = 1;
     tftp->is_put = is_put;
     tftp->tftp_filename = strdup(tftp_filename);
     tftp->disk_filename = strdup(disk_filename);
+    tftp->mc_requested = !is_put && get_environment_variable_int("tftp_multicast", 0);
+
+    return tftp;
+}
+
+// the ring holds several windows of full sized blocks, if the heap allows
+static void tftp_alloc_prefetch_ring(tftp_transfer_t *tftp)
+{
+    int size = (TFTP_PREFETCH_WINDOWS * TFTP_MAX_WINDOW * TFTP_MAX_BLOCK_SIZE + TFTP_PREFETCH_CHUNK - 1) &
+               ~(TFTP_PREFETCH_CHUNK - 1);
+
+    for(; size >= TFTP_PREFETCH_CHUNK; size = (size / 2) & ~(TFTP_PREFETCH_CHUNK - 1)){
+        tftp->prefetch_ring = malloc_unchecked(size);
+        if(tftp->prefetch_ring){
+            tftp->prefetch_size = size;
+            return;
+        }
+    }
+}
+
+static void tftp_free(tftp_transfer_t *tftp)
+{
+    free(tftp->tftp_filename);
+    free(tftp->disk_filename);
+    write_buffer_free(&tftp->write_buffer);
+    free(tftp->prefetch_ring);
+    free(tftp->mc_bitmap);
+    packet_queue_drain(&tftp->data_queue);
+    free(tftp);
+}
+
+static void tftp_print_server(uint32_t tftp_server_ip, tftp_transfer_t *tftp)
+{
+    printf("tftp: %s %d.%d.%d.%d:%s",
+            tftp->is_put ? "put" : "get",
+            (int)(tftp_server_ip >> 24 & 0xff),
+            (int)(tftp_server_ip >> 16 & 0xff),
+            (int)(tftp_server_ip >>  8 & 0xff),
+            (int)(tftp_server_ip       & 0xff),
+            tftp->tftp_filename);
+}
+
+// run the transfer to completion; the caller has set up the data source/destination
+static bool tftp_run(uint32_t tftp_server_ip, tftp_transfer_t *tftp)
+{
+    uint32_t start, taken, rate;
+    int uart_byte, reported_transferred;
+    packet_sink_t *sink = packet_sink_alloc();
+
+    sink->match_interface_local_ip = true;
+    sink->match_ipv4_protocol = ip_proto_udp;
+    sink->match_remote_ip = tftp_server_ip;
+    sink->match_local_port = 8192 + (gogoboot_read_timer() & 0x7fff);
+    sink->sink_private = tftp;
+    tftp->sink = sink;
+    if(tftp->memory){
+        // armed once we know the server's port
+        sink->rx_direct_header = 4; // opcode, block number
+        sink->cb_rx_direct = tftp_rx_direct;
+    }
+
+    start = gogoboot_read_timer();
+    sink->cb_packet_received = tftp_client_packet_received;
+    sink->cb_timer_expired = tftp_client_timer_expired;
+    net_add_packet_sink(sink);
+    tftp_client_timer_expired(sink); // synthesise a timeout; triggers transmission of RRQ/WRQ
+    tftp->timeouts = 0; // fixup counts, since our "timeout" was synthetic
+    tftp->retransmits_this_block = 0; 
+
+    printf("Transfer started: Press Q to abort\n");
+
+    reported_transferred = 0;
+    while(!tftp->completed){
+        net_pump(); // this calls our callsbacks to make the transfer go
+        if(tftp->prefetch_ring && !tftp->completed && !tftp_put_prefetch(tftp)){
+            tftp->completed = true; // use the idle time to read ahead
+            tftp->success = false;
+        }
+        uart_byte = uart_read_byte();
+        if(uart_byte == 'q' || uart_byte == 'Q'){
+            printf("Aborted.\n");
+            break;
+        }
+        if((tftp->bytes_transferred - reported_transferred) >= (256*1024) || 
+           (tftp->total_size && tftp->bytes_transferred >= tftp->total_size)){
+            reported_transferred = tftp->bytes_transferred;
+            if(tftp->total_size){
+                if(reported_transferred > tftp->total_size)
+                    reported_transferred = tftp->total_size;
+                printf("tftp: %d/%d KB", reported_transferred >> 10, tftp->total_size >> 10);
+            }else
+                printf("tftp: %d KB", reported_transferred >> 10);
+            if(tftp->timeouts)
+                printf(" (%d timeouts)", tftp->timeouts);
+            printf("\n");
+        }
+    }
+
+    if(tftp->success){
+        printf("Transfer success.\n");
+        taken = gogoboot_read_timer() - start;
+        taken /= (TIMER_HZ/10); // taken is now in 10ths of a second
+        if(taken == 0)
+            taken = 1; // avoid div 0
+        rate = ((tftp->bytes_transferred / taken)*8) / 1000;
+        printf("Transferred %d bytes in %ld.%lds (%ld.%02ld Mbit/sec)\n",
+                tftp->bytes_transferred, taken/10, taken%10, rate/100, rate%100);
+        if(tftp->multicast)
+            printf("blksize %d, multicast, %d timeouts, %d out of order\n",
+                    tftp->block_size, tftp->timeouts, tftp->out_of_order);
+        else
+            printf("blksize %d, windowsize %d, %d timeouts, %d out of order; next window limit %d\n",
+                    tftp->block_size, tftp->window_size, tftp->timeouts, tftp->out_of_order, tftp_window_limit);
+        if(tftp->direct_blocks)
+            printf("%d blocks received in place\n", tftp->direct_blocks);
+        if(!tftp->is_put && !tftp->data_cb && tftp->windows){
+            taken = tftp->write_buffer.write_ticks * TIMER_MS_PER_TICK;
+            printf("disk writes took %ld ms, %ld us per window (%d byte write buffer)\n",
+                    taken, taken * 1000 / tftp->windows, tftp->write_buffer.size);
+        }
+    }else{
+        printf("Transfer FAILED!\n");
+    }
+
+    // unregister the sinks
+    if(tftp->mc_sink){
+        net_remove_packet_sink(tftp->mc_sink);
+        packet_sink_free(tftp->mc_sink);
+        tftp->mc_sink = NULL;
+        net_multicast_leave(tftp->mc_group);
+    }
+    net_remove_packet_sink(sink);
+    packet_sink_free(sink);
+
+    return tftp->success;
+}
+
+bool tftp_transfer(uint32_t tftp_server_ip, const char *tftp_filename, 
+        const char *disk_filename, bool is_put)
+{
+    FRESULT fr;
+    bool success = false;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, disk_filename, is_put);
 
     if(is_put){
         fr = f_open(&tftp->disk_file, tftp->disk_filename, FA_READ);
         tftp->total_size = f_size(&tftp->disk_file);
-    }else
+        if(fr == FR_OK)
+            tftp_alloc_prefetch_ring(tftp);
+    }else{
         fr = f_open(&tftp->disk_file, tftp->disk_filename, FA_WRITE | FA_CREATE_ALWAYS);
+        // set the tftp_write_buffer environment variable to the size in KB
+        // to override the default, or 0 to write each block as it arrives
+        if(fr == FR_OK)
+            write_buffer_init(&tftp->write_buffer, "tftp", &tftp->disk_file, tftp->disk_filename,
+                    get_environment_variable_int("tftp_write_buffer", TFTP_WRITE_BUFFER));
+    }
 
     if(fr != FR_OK){
         printf("tftp: failed to open \"%s\": %s\n", tftp->disk_filename, f_errmsg(fr));
     }else{
-        printf("tftp: %s %d.%d.%d.%d:%s %s local file \"%s\"",
-                is_put ? "put" : "get",
-                (int)(tftp_server_ip >> 24 & 0xff),
-                (int)(tftp_server_ip >> 16 & 0xff),
-                (int)(tftp_server_ip >>  8 & 0xff),
-                (int)(tftp_server_ip       & 0xff),
-                tftp->tftp_filename,
-                is_put ? "from" : "to",
-                tftp->disk_filename);
+        tftp_print_server(tftp_server_ip, tftp);
+        printf(" %s local file \"%s\"", is_put ? "from" : "to", tftp->disk_filename);
         if(is_put)
             printf(" %d bytes", tftp->total_size);
         putchar('\n');
 
-        start = gogoboot_read_timer();
-        sink->cb_packet_received = tftp_client_packet_received;
-        sink->cb_timer_expired = tftp_client_timer_expired;
-        net_add_packet_sink(sink);
-        tftp_client_timer_expired(sink); // synthesise a timeout; triggers transmission of RRQ/WRQ
-        tftp->timeouts = 0; // fixup counts, since our "timeout" was synthetic
-        tftp->retransmits_this_block = 0; 
+        success = tftp_run(tftp_server_ip, tftp);
 
-        printf("Transfer started: Press Q to abort\n");
+        // close the file
+        f_close(&tftp->disk_file);
+    }
 
-        reported_transferred = 0;
-        while(!tftp->completed){
-            net_pump(); // this calls our callsbacks to make the transfer go
-            uart_byte = uart_read_byte();
-            if(uart_byte == 'q' || uart_byte == 'Q'){
-                printf("Aborted.\n");
-                break;
-            }
-            if((tftp->bytes_transferred - reported_transferred) >= (256*1024) || 
-               (tftp->total_size && tftp->bytes_transferred >= tftp->total_size)){
-                reported_transferred = tftp->bytes_transferred;
-                if(tftp->total_size){
-                    if(reported_transferred > tftp->total_size)
-                        reported_transferred = tftp->total_size;
-                    printf("tftp: %d/%d KB", reported_transferred >> 10, tftp->total_size >> 10);
-                }else
-                    printf("tftp: %d KB", reported_transferred >> 10);
-                if(tftp->timeouts)
-                    printf(" (%d timeouts)", tftp->timeouts);
-                printf("\n");
-            }
-        }
+    tftp_free(tftp);
 
-        if(tftp->success){
-            printf("Transfer success.\n");
-            taken = gogoboot_read_timer() - start;
-            taken /= (TIMER_HZ/10); // taken is now in 10ths of a second
-            if(taken == 0)
-                taken = 1; // avoid div 0
-            rate = ((tftp->bytes_transferred / taken)*8) / 1000;
-            printf("Transferred %d bytes in %ld.%lds (%ld.%02ld Mbit/sec)\n",
-                    tftp->bytes_transferred, taken/10, taken%10, rate/100, rate%100);
-        }else{
-            printf("Transfer FAILED!\n");
-        }
+    return success;
+}
 
-        // close the file
-        f_close(&tftp->disk_file);
+static bool tftp_memory_write(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size);
 
-        // unregister the sink
-        net_remove_packet_sink(sink);
+// multicast blocks arrive in any order, so we only ask for multicast when
+// data_cb can take them that way; tftp_load() can, and can also have the
+// driver receive blocks in place
+static bool tftp_receive_common(uint32_t tftp_server_ip, const char *tftp_filename,
+        tftp_data_cb_t data_cb, void *data_cb_private, bool any_order)
+{
+    bool success;
+    tftp_transfer_t *tftp = tftp_alloc(tftp_filename, "", false);
+
+    tftp->data_cb = data_cb;
+    tftp->data_cb_private = data_cb_private;
+    if(!any_order)
+        tftp->mc_requested = false;
+    if(data_cb == tftp_memory_write)
+        tftp->memory = data_cb_private;
+
+    tftp_print_server(tftp_server_ip, tftp);
+    putchar('\n');
+
+    success = tftp_run(tftp_server_ip, tftp);
+
+    tftp_free(tftp);
+
+    return success;
+}
+
+bool tftp_receive(uint32_t tftp_server_ip, const char *tftp_filename,
+        tftp_data_cb_t data_cb, void *data_cb_private)
+{
+    return tftp_receive_common(tftp_server_ip, tftp_filename, data_cb, data_cb_private, false);
+}
+
+static bool tftp_memory_write(void *cb_private, uint32_t offset, const void *data, int length, uint32_t total_size)
+{
+    tftp_memory_target_t *target = cb_private;
+
+    // once we know the file size, check the whole range up front; this also
+    // grows the bounce buffer in one step rather than a block at a time.
+    // multicast blocks can arrive in any order, so this need not be offset 0
+    if(!target->reserved && total_size){
+        if(!load_reserve(target->load_address, total_size))
+            return false;
+        target->reserved = true;
     }
 
-    packet_sink_free(sink);
-    free(tftp->tftp_filename);
-    free(tftp->disk_filename);
-    packet_queue_drain(&tftp->data_queue);
-    free(tftp);
+    // blocks received with tftp_rx_direct() are in place already
+    if(data != load_data_pointer(target->load_address + offset, length) &&
+       !load_data_buffer(target->load_address + offset, data, length))
+        return false;
 
+    if(offset + length > target->load_size)
+        target->load_size = offset + length;
     return true;
 }
+
+bool tftp_load(uint32_t tftp_server_ip, const char *tftp_filename, uint32_t load_address, uint32_t *load_size)
+{
+    tftp_memory_target_t target;
+    bool success;
+
+    target.load_address = load_address;
+    target.load_size = 0;
+    target.reserved = false;
+
+    printf("tftp: loading \"%s\" to memory at 0x%lx\n", tftp_filename, load_address);
+    success = tftp_receive_common(tftp_server_ip, tftp_filename, tftp_memory_write, &target, true);
+
+    if(load_size)
+        *load_size = target.load_size;
+
+    return success;
+}
@@ -0,0 +1,113 @@
+/* (c) 2023 William R Sowerbutts <will@sowerbutts.com> */
+
+#include <types.h>
+#include <stdlib.h>
+#include <timers.h>
+#include <fatfs/ff.h>
+#include <cli.h>
+#include <net.h>
+
+// Write coalescing for tftp.c and http.c, which receive a file in pieces of
+// a packet or so. The pieces are collected in a buffer that is a whole
+// number of clusters, and the buffer is written out only when it is full.
+// Every write then starts on a cluster boundary, so FatFs can transfer it
+// straight from our buffer in multi-sector writes. When the file does not
+// start on a cluster boundary (eg resuming an http transfer), the first
+// flush is cut short to reach one.
+
+static int write_buffer_cluster_size(write_buffer_t *wb)
+{
+    return wb->file->obj.fs->csize * FF_MAX_SS;
+}
+
+// kbytes is rounded to a whole number of clusters; we fall back to smaller
+// buffers, and finally none, when the heap is small
+void write_buffer_init(write_buffer_t *wb, const char *owner, FIL *file, const char *filename, int kbytes)
+{
+    int cluster_size, clusters;
+
+    memset(wb, 0, sizeof(write_buffer_t));
+    wb->owner = owner;
+    wb->file = file;
+    wb->filename = filename;
+
+    if(kbytes <= 0)
+        return;
+
+    cluster_size = write_buffer_cluster_size(wb);
+    clusters = (kbytes << 10) / cluster_size;
+    if(clusters < 1)
+        clusters = 1;
+
+    for(; clusters >= 1; clusters /= 2){
+        wb->buffer = malloc_unchecked(clusters * cluster_size);
+        if(wb->buffer){
+            wb->size = clusters * cluster_size;
+            wb->limit = wb->size - (f_tell(file) % cluster_size);
+            return;
+        }
+    }
+}
+
+void write_buffer_free(write_buffer_t *wb)
+{
+    free(wb->buffer);
+    wb->buffer = NULL;
+    wb->size = 0;
+    wb->used = 0;
+}
+
+// write to the file at its current position, bypassing the buffer
+bool write_buffer_write_file(write_buffer_t *wb, const void *data, int size)
+{
+    FRESULT fr;
+    UINT written;
+    timer_t start;
+
+    start = gogoboot_read_timer();
+    fr = f_write(wb->file, data, size, &written);
+    wb->write_ticks += gogoboot_read_timer() - start;
+
+    if(fr != FR_OK){
+        printf("%s: failed to write to \"%s\": %s\n", wb->owner, wb->filename, f_errmsg(fr));
+        return false;
+    }
+    if(written != size){
+        printf("%s: failed to write to \"%s\": disk full\n", wb->owner, wb->filename);
+        return false;
+    }
+    return true;
+}
+
+bool write_buffer_flush(write_buffer_t *wb)
+{
+    bool ok = true;
+
+    if(wb->used)
+        ok = write_buffer_write_file(wb, wb->buffer, wb->used);
+    wb->used = 0;
+    wb->limit = wb->size; // we are on a cluster boundary from here on
+    return ok;
+}
+
+bool write_buffer_write(write_buffer_t *wb, const void *data, int size)
+{
+    const uint8_t *src = data;
+    int chunk;
+
+    if(!wb->buffer)
+        return write_buffer_write_file(wb, data, size);
+
+    while(size){
+        chunk = wb->limit - wb->used;
+        if(chunk > size)
+            chunk = size;
+        memcpy(wb->buffer + wb->used, src, chunk);
+        wb->used += chunk;
+        src += chunk;
+        size -= chunk;
+        if(wb->used == wb->limit && !write_buffer_flush(wb))
+            return false;
+    }
+    return true;
+}
@@ -15,22 +15,24 @@
 static disk_controller_t disk_controller[NUM_CONTROLLERS];
 static const uint32_t controller_base_io_addr[] = { 0x1f0, 0x170 };
 
-void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
+void ide_transfer_block_read(disk_controller_t *ctrl, void *ptr, int nsectors)
 {
-    uint16_t *buffer = ptr;
+    ide_block_xfer_input(ptr, ctrl->data_reg, nsectors);
+}
 
-    for(int i=0; i<256; i++){
-        *(buffer++) = __builtin_bswap16(*ctrl->data_reg);
-    }
+void ide_transfer_block_write(disk_controller_t *ctrl, const void *ptr, int nsectors)
+{
+    ide_block_xfer_output(ptr, ctrl->data_reg, nsectors);
 }
 
-void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+void ide_transfer_sector_read(disk_controller_t *ctrl, void *ptr)
 {
-    const uint16_t *buffer = ptr;
+    ide_transfer_block_read(ctrl, ptr, 1);
+}
 
-    for(int i=0; i<256; i++){
-        *ctrl->data_reg = __builtin_bswap16(*(buffer++));
-    }
+void ide_transfer_sector_write(disk_controller_t *ctrl, const void *ptr)
+{
+    ide_transfer_block_write(ctrl, ptr, 1);
 }
 
 uint8_t ide_get_register(disk_controller_t *ctrl, int reg)
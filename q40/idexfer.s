@@ -0,0 +1,102 @@
+        .globl  ide_block_xfer_input
+        .globl  ide_block_xfer_output
+
+        .text
+        .even
+
+/* IDE data register transfers for the 16-bit ISA bus on Q40, a whole
+   multi-sector block per call.
+
+   IDE data is little-endian, so every word is byte swapped in a register
+   (ror.w #8) on the way through, as the NE2000 transfers are. The loops
+   move 16 bytes per iteration, assembling four longwords in registers and
+   storing or loading them with a single movem.l burst. The data port
+   address passed in is the ISA-translated word address of the port. */
+
+/* void ide_block_xfer_input(void *buf, volatile uint16_t *port, int nsectors) */
+ide_block_xfer_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* sectors */
+
+    /* save registers */
+    movem.l %d2-%d4,-(%sp)
+
+    lsl.l #5,%d0                /* 32x16=512 bytes per sector */
+    bra.s ide_in_blockloop
+
+ide_in_block:
+    move.w %a1@,%d1             /* read a word */
+    ror.w #8,%d1                /* swap bytes */
+    swap %d1                    /* move to the top half */
+    move.w %a1@,%d1             /* read the next word */
+    ror.w #8,%d1
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    swap %d2
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    swap %d3
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    swap %d4
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    movem.l %d1-%d4,%a0@        /* store 16 bytes */
+    lea %a0@(16),%a0
+ide_in_blockloop:
+    dbra %d0, ide_in_block
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d4
+    rts
+
+/* void ide_block_xfer_output(const void *buf, volatile uint16_t *port, int nsectors) */
+ide_block_xfer_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* sectors */
+
+    /* save registers */
+    movem.l %d2-%d4,-(%sp)
+
+    lsl.l #5,%d0                /* 32x16=512 bytes per sector */
+    bra.s ide_out_blockloop
+
+ide_out_block:
+    movem.l %a0@+,%d1-%d4       /* load 16 bytes */
+    swap %d1                    /* first word is in the top half */
+    ror.w #8,%d1                /* swap bytes */
+    move.w %d1,%a1@             /* write a word */
+    swap %d1
+    ror.w #8,%d1
+    move.w %d1,%a1@
+    swap %d2
+    ror.w #8,%d2
+    move.w %d2,%a1@
+    swap %d2
+    ror.w #8,%d2
+    move.w %d2,%a1@
+    swap %d3
+    ror.w #8,%d3
+    move.w %d3,%a1@
+    swap %d3
+    ror.w #8,%d3
+    move.w %d3,%a1@
+    swap %d4
+    ror.w #8,%d4
+    move.w %d4,%a1@
+    swap %d4
+    ror.w #8,%d4
+    move.w %d4,%a1@
+ide_out_blockloop:
+    dbra %d0, ide_out_block
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d4
+    rts
+        .end
@@ -0,0 +1,217 @@
+        .globl  ne2000_pio_input
+        .globl  ne2000_pio_input_sum
+        .globl  ne2000_pio_output
+
+        .text
+        .even
+
+/* NE2000 remote DMA data port transfers for the 16-bit ISA bus on Q40.
+
+   The card is a little-endian ISA device: each word moved through the data
+   port carries the first byte of the pair in its low half, so every word is
+   byte swapped in a register (ror.w #8) on the way through. The main loops
+   move 16 bytes per iteration, assembling four longwords in registers and
+   storing or loading them with a single movem.l burst. The data port
+   address passed in is the ISA-translated word address of the port. */
+
+/* void ne2000_pio_input(void *buf, volatile uint16_t *port, unsigned int len) */
+ne2000_pio_input:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    /* save registers */
+    movem.l %d2-%d5,-(%sp)
+
+    move.l %d0,%d5              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_in_blockloop
+
+pio_in_block:
+    move.w %a1@,%d1             /* read a word */
+    ror.w #8,%d1                /* swap bytes */
+    swap %d1                    /* move to the top half */
+    move.w %a1@,%d1             /* read the next word */
+    ror.w #8,%d1
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    swap %d2
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    swap %d3
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    swap %d4
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    movem.l %d1-%d4,%a0@        /* store 16 bytes */
+    lea %a0@(16),%a0
+pio_in_blockloop:
+    dbra %d0, pio_in_block
+
+    move.w %d5,%d0
+    andi.w #15,%d0
+    lsr.w #1,%d0                /* remaining whole words */
+    bra.s pio_in_wordloop
+pio_in_word:
+    move.w %a1@,%d1
+    ror.w #8,%d1
+    move.w %d1,%a0@+
+pio_in_wordloop:
+    dbra %d0, pio_in_word
+
+    btst #0,%d5                 /* odd length? */
+    beq.s pio_in_done
+    move.w %a1@,%d1             /* final byte is in the low half */
+    move.b %d1,%a0@
+
+pio_in_done:
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d5
+    rts
+
+/* uint32_t ne2000_pio_input_sum(void *buf, volatile uint16_t *port, unsigned int len)
+
+   As ne2000_pio_input, but also returns the one's complement sum of the data
+   (padded with a zero byte if len is odd), folded to at most 17 bits. */
+ne2000_pio_input_sum:
+    moveal %sp@(4),%a0          /* void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    /* save registers */
+    movem.l %d2-%d7,-(%sp)
+
+    moveq #0,%d6                /* running sum */
+    moveq #0,%d7                /* constant zero, to fold in the carry */
+    move.l %d0,%d5              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_ins_blockloop
+
+pio_ins_block:
+    move.w %a1@,%d1
+    ror.w #8,%d1
+    swap %d1
+    move.w %a1@,%d1
+    ror.w #8,%d1
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    swap %d2
+    move.w %a1@,%d2
+    ror.w #8,%d2
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    swap %d3
+    move.w %a1@,%d3
+    ror.w #8,%d3
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    swap %d4
+    move.w %a1@,%d4
+    ror.w #8,%d4
+    movem.l %d1-%d4,%a0@        /* store 16 bytes */
+    lea %a0@(16),%a0
+    add.l %d1,%d6               /* sum them while still in registers */
+    addx.l %d2,%d6
+    addx.l %d3,%d6
+    addx.l %d4,%d6
+    addx.l %d7,%d6              /* end around carry */
+pio_ins_blockloop:
+    dbra %d0, pio_ins_block
+
+    move.w %d5,%d0
+    andi.w #15,%d0
+    lsr.w #1,%d0                /* remaining whole words */
+    moveq #0,%d1
+    bra.s pio_ins_wordloop
+pio_ins_word:
+    move.w %a1@,%d1
+    ror.w #8,%d1
+    move.w %d1,%a0@+
+    add.l %d1,%d6
+    addx.l %d7,%d6
+pio_ins_wordloop:
+    dbra %d0, pio_ins_word
+
+    btst #0,%d5                 /* odd length? */
+    beq.s pio_ins_fold
+    move.w %a1@,%d1             /* final byte is in the low half */
+    move.b %d1,%a0@
+    lsl.w #8,%d1                /* move it to the top, pad with zero */
+    add.l %d1,%d6
+    addx.l %d7,%d6
+
+pio_ins_fold:
+    move.l %d6,%d0
+    clr.w %d6
+    swap %d6                    /* high word */
+    andi.l #0xffff,%d0          /* low word */
+    add.l %d6,%d0               /* at most 0x1fffe */
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d7
+    rts
+
+/* void ne2000_pio_output(const void *buf, volatile uint16_t *port, unsigned int len)
+
+   An odd len is rounded up to a whole number of words. */
+ne2000_pio_output:
+    moveal %sp@(4),%a0          /* const void *buf */
+    moveal %sp@(8),%a1          /* data port */
+    move.l %sp@(12),%d0         /* length in bytes */
+
+    /* save registers */
+    movem.l %d2-%d5,-(%sp)
+
+    addq.l #1,%d0               /* round up to whole words */
+    move.l %d0,%d5              /* keep length for the tail */
+    lsr.l #4,%d0                /* 16 bytes per block */
+    bra.s pio_out_blockloop
+
+pio_out_block:
+    movem.l %a0@+,%d1-%d4       /* load 16 bytes */
+    swap %d1                    /* first word is in the top half */
+    ror.w #8,%d1                /* swap bytes */
+    move.w %d1,%a1@             /* write a word */
+    swap %d1
+    ror.w #8,%d1
+    move.w %d1,%a1@
+    swap %d2
+    ror.w #8,%d2
+    move.w %d2,%a1@
+    swap %d2
+    ror.w #8,%d2
+    move.w %d2,%a1@
+    swap %d3
+    ror.w #8,%d3
+    move.w %d3,%a1@
+    swap %d3
+    ror.w #8,%d3
+    move.w %d3,%a1@
+    swap %d4
+    ror.w #8,%d4
+    move.w %d4,%a1@
+    swap %d4
+    ror.w #8,%d4
+    move.w %d4,%a1@
+pio_out_blockloop:
+    dbra %d0, pio_out_block
+
+    move.w %d5,%d0
+    andi.w #15,%d0
+    lsr.w #1,%d0                /* remaining whole words */
+    bra.s pio_out_wordloop
+pio_out_word:
+    move.w %a0@+,%d1
+    ror.w #8,%d1
+    move.w %d1,%a1@
+pio_out_wordloop:
+    dbra %d0, pio_out_word
+
+    /* restore registers, return */
+    movem.l (%sp)+,%d2-%d5
+    rts